@@ -0,0 +1,400 @@
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "miner.h"
+#include "hash.h"
+#include "stats.h"
+#include "shard.h"
+
+#define TRUE 1
+#define FALSE 0
+
+#define FORMAT_CSV 0
+#define FORMAT_JSON 1
+
+#define MAX_RESULTS 256
+#define MAX_THREADS 64
+#define MAX_NETS 16
+
+/* Calls of the hash function between two looks at the clock */
+#define HASH_STEP (1<<20)
+
+
+struct result_struct {
+    char bench[32];
+    char kernel[16];
+    int threads;
+    int miners;
+    int workers;
+    char metric[32];
+    double value;
+    char unit[16];
+};
+
+
+
+
+
+/**********************
+ ** Global variables **
+ **********************/
+static struct result_struct results[MAX_RESULTS];
+static int n_results = 0;
+static volatile sig_atomic_t run = TRUE;
+static volatile uint64_t sink; /* Keeps hashes nobody reads from being optimized out */
+
+
+
+
+/*************
+ ** Results **
+ *************/
+
+/* Private */
+void add_result(const char *bench, int threads, int miners, int workers, const char *metric, double value, const char *unit) {
+    struct result_struct *r;
+
+    if (n_results == MAX_RESULTS) return;
+    r = results + n_results++;
+
+    snprintf(r->bench, sizeof(r->bench), "%s", bench);
+    snprintf(r->kernel, sizeof(r->kernel), "%s", hash_kernel_name());
+    r->threads = threads;
+    r->miners = miners;
+    r->workers = workers;
+    snprintf(r->metric, sizeof(r->metric), "%s", metric);
+    r->value = value;
+    snprintf(r->unit, sizeof(r->unit), "%s", unit);
+}
+
+/* Private. One row or object per result, fields that do not apply are 0 */
+void print_results(int format) {
+    struct result_struct *r;
+    int i;
+
+    if (format == FORMAT_CSV) printf("bench,backend,kernel,threads,miners,workers,metric,value,unit\n");
+    else printf("[\n");
+
+    for (i=0; i<n_results; i++) {
+        r = results + i;
+        if (format == FORMAT_CSV) {
+            printf("%s,%s,%s,%d,%d,%d,%s,%.6g,%s\n", r->bench, hash_backend()->name, r->kernel, r->threads, r->miners, r->workers, r->metric, r->value, r->unit);
+        }
+        else {
+            printf("  {\"bench\": \"%s\", \"backend\": \"%s\", \"kernel\": \"%s\", \"threads\": %d, \"miners\": %d, \"workers\": %d, \"metric\": \"%s\", \"value\": %.6g, \"unit\": \"%s\"}%s\n",
+                r->bench, hash_backend()->name, r->kernel, r->threads, r->miners, r->workers, r->metric, r->value, r->unit, (i+1 < n_results) ? "," : "");
+        }
+    }
+
+    if (format == FORMAT_JSON) printf("]\n");
+}
+
+
+
+
+/**********************
+ ** Micro-benchmarks **
+ **********************/
+
+/* Private. The hash function, one call at a time */
+void bench_hash(double seconds) {
+    uint64_t start = stats_now(), deadline = start + seconds*1e9, n = 0, i, x = 0;
+
+    do {
+        for (i=0; i<HASH_STEP; i++) x ^= simple_hash((n + i) % hash_keyspace());
+        n += HASH_STEP;
+    } while (stats_now() < deadline);
+    sink = x;
+
+    add_result("hash", 1, 0, 0, "rate", n/((stats_now() - start)/1e9), "hash/s");
+}
+
+/* Private. The batch entry point, as the chain validator calls it */
+void bench_hash_batch(double seconds) {
+    uint64_t numbers[1024], hashes[1024];
+    uint64_t start = stats_now(), deadline = start + seconds*1e9, n = 0, x = 0;
+    int i;
+
+    do {
+        for (i=0; i<1024; i++) numbers[i] = (n + i) % hash_keyspace();
+        hash_batch(numbers, hashes, 1024);
+        x ^= hashes[n % 1024];
+        n += 1024;
+    } while (stats_now() < deadline);
+    sink = x;
+
+    add_result("hash_batch", 1, 0, 0, "rate", n/((stats_now() - start)/1e9), "hash/s");
+}
+
+/* Private. The miner's worker pool with n_threads workers, returns hashes/s. Workers
+ * sweep the whole keyspace for the hash of its last candidate, so a search only ends
+ * early on narrow keyspaces and is then handed out again */
+double bench_search(int n_threads, double seconds) {
+    struct worker_pool_struct pool;
+    struct timespec deadline;
+    uint64_t hashes[n_threads], target, solution, start, total = 0;
+    uint32_t epoch = 0;
+    int i, win, ended;
+
+    for (i=0; i<n_threads; i++) hashes[i] = 0;
+    if (setup_workers(&pool, n_threads, &epoch, &run, hashes, n_threads) != EXIT_SUCCESS) return 0;
+
+    target = simple_hash(hash_keyspace() - 1);
+    start = stats_now();
+    deadline.tv_sec = (start + (uint64_t)(seconds*1e9))/1000000000;
+    deadline.tv_nsec = (start + (uint64_t)(seconds*1e9))%1000000000;
+
+    do {
+        load_workers(&pool, target, 0, hash_keyspace(), ORDER_SEQUENTIAL, epoch + 2);
+        ended = wait_workers(&pool, &deadline);
+        if (ended) collect_workers(&pool, &solution, &win);
+        else cancel_workers(&pool);
+    } while (ended && run);
+
+    destroy_workers(&pool);
+    for (i=0; i<n_threads; i++) total += hashes[i];
+
+    return total/((stats_now() - start)/1e9);
+}
+
+/* Private. A multi-target sweep for n_targets targets on one thread, returns
+ * candidates/s. Targets are hashes of the last candidates, never found below them */
+double bench_search_multi(int n_targets, double seconds) {
+    uint64_t list[n_targets], solutions[n_targets], span, pos = 0, len, n = 0, start, deadline;
+    HashTargets targets;
+    int i;
+
+    span = hash_keyspace() - n_targets;
+    for (i=0; i<n_targets; i++) list[i] = simple_hash(span + i);
+    if (hash_targets_init(&targets, list, n_targets) != EXIT_SUCCESS) return 0;
+    for (i=0; i<n_targets; i++) solutions[i] = HASH_NONE;
+
+    start = stats_now();
+    deadline = start + seconds*1e9;
+    do {
+        /* Keyspaces narrower than a chunk are searched whole */
+        len = (span - pos < WORK_CHUNK) ? span - pos : WORK_CHUNK;
+        hash_search_multi(pos, pos + len, &targets, solutions, &run);
+        n += len;
+        pos = (pos + len < span) ? pos + len : 0;
+    } while (stats_now() < deadline);
+
+    hash_targets_free(&targets);
+
+    return n/((stats_now() - start)/1e9);
+}
+
+/* Private. Every search kernel this host runs, on 1, 2, 4... up to max_threads */
+void bench_kernels(const char *backend_name, int max_threads, double seconds) {
+    static const char *kernels[] = {"scalar", "avx2", "avx512"};
+    static const int batches[] = {1, 4, 16, 256};
+    char metric[32];
+    double rate;
+    int k, n;
+
+    for (k=0; k<3; k++) {
+        /* hash_setup falls back to another kernel if the host lacks this one */
+        setenv("HASH_KERNEL", kernels[k], 1);
+        if (hash_setup(backend_name) != EXIT_SUCCESS) break;
+        if (strcmp(hash_kernel_name(), kernels[k]) != 0) continue;
+
+        for (n=1; ; n = (2*n < max_threads) ? 2*n : max_threads) {
+            rate = bench_search(n, seconds);
+            add_result("search", n, 0, 0, "rate", rate, "hash/s");
+            add_result("search", n, 0, 0, "rate_per_thread", rate/n, "hash/s");
+            if (n == max_threads) break;
+        }
+
+        /* One sweep for a batch of targets, as miner -T runs it */
+        for (n=0; n<4; n++) {
+            snprintf(metric, sizeof(metric), "rate_%d_targets", batches[n]);
+            add_result("search_multi", 1, 0, 0, metric, bench_search_multi(batches[n], seconds), "hash/s");
+        }
+    }
+
+    unsetenv("HASH_KERNEL");
+    hash_setup(backend_name);
+}
+
+
+
+
+/*************
+ ** Harness **
+ *************/
+
+/* Private. Waits for the net's stats segment to be created and opens it */
+int wait_stats(Stats *stats, pid_t *pids, int n_miners) {
+    int fd, i, status, ret;
+
+    for (;;) {
+        if ((fd = shm_open(shard_shm(SHM_NAME_STATS), O_RDONLY, 0)) != -1) {
+            close(fd);
+            if ((ret = stats_open(stats, FALSE)) != STATS_NOT_READY) return ret;
+        }
+        for (i=0; i<n_miners; i++) {
+            if (waitpid(pids[i], &status, WNOHANG) == pids[i]) {
+                fprintf(stderr, "Error: miner %d ended before the net's stats were kept\n", pids[i]);
+                return EXIT_FAILURE;
+            }
+        }
+        usleep(1000);
+    }
+}
+
+/* Private. Forks n_miners miners with n_workers workers each, n_rounds rounds, and
+ * takes the net's figures from its stats segment. The mapping outlives the segment,
+ * which the last miner unlinks */
+int bench_net(const char *miner_path, const char *backend_name, int n_miners, int n_workers, int n_rounds) {
+    Stats stats;
+    Histogram phases[STATS_PHASES];
+    pid_t pids[n_miners];
+    char workers_str[16], rounds_str[16];
+    uint64_t start, wins = 0, hashes = 0;
+    double seconds;
+    int i, j, k, fd, status, failed = FALSE;
+
+    if ((fd = shm_open(shard_shm(SHM_NAME_NET), O_RDONLY, 0)) != -1) {
+        close(fd);
+        fprintf(stderr, "Error: a net is already running\n");
+        return EXIT_FAILURE;
+    }
+    shm_unlink(shard_shm(SHM_NAME_STATS)); /* Left by a net that crashed */
+
+    snprintf(workers_str, sizeof(workers_str), "%d", n_workers);
+    snprintf(rounds_str, sizeof(rounds_str), "%d", n_rounds);
+
+    start = stats_now();
+    for (i=0; i<n_miners; i++) {
+        if ((pids[i] = fork()) == -1) {
+            perror("Error: could not start miner\nfork");
+            for (i--; i>=0; i--) kill(pids[i], SIGINT);
+            while (wait(NULL) > 0);
+            return EXIT_FAILURE;
+        }
+        if (pids[i] == 0) {
+            /* Only the figures matter, not the miner's output */
+            if (freopen("/dev/null", "w", stdout) == NULL) {
+                perror("Error: could not discard miner output\nfreopen");
+                _exit(EXIT_FAILURE);
+            }
+            if (backend_name != NULL) execl(miner_path, miner_path, "-q", "-b", backend_name, workers_str, rounds_str, (char*) NULL);
+            else execl(miner_path, miner_path, "-q", workers_str, rounds_str, (char*) NULL);
+            perror("Error: could not run miner\nexecl");
+            _exit(EXIT_FAILURE);
+        }
+    }
+
+    stats.header = NULL;
+    if (wait_stats(&stats, pids, n_miners) != EXIT_SUCCESS) failed = TRUE;
+
+    for (i=0; i<n_miners; i++) {
+        if (waitpid(pids[i], &status, 0) == pids[i] && (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)) failed = TRUE;
+    }
+    seconds = (stats_now() - start)/1e9;
+
+    if (failed) {
+        fprintf(stderr, "Error: a net of %d miners did not end cleanly\n", n_miners);
+        stats_close(&stats);
+        return EXIT_FAILURE;
+    }
+
+    /* Slots of miners that left are kept, only their pid is cleared */
+    memset(phases, 0, sizeof(phases));
+    for (i=0; i<STATS_MAX_MINERS; i++) {
+        if (stats.miners[i].rounds == 0) continue;
+        for (k=0; k<STATS_PHASES; k++) stats_merge(phases+k, stats.miners[i].phases+k);
+        for (j=0; j<STATS_MAX_WORKERS; j++) hashes += stats.miners[i].hashes[j];
+        wins += stats.miners[i].wins;
+    }
+    stats_close(&stats);
+
+    add_result("net", 0, n_miners, n_workers, "rounds_per_s", wins/seconds, "round/s");
+    add_result("net", 0, n_miners, n_workers, "hash_rate", hashes/seconds, "hash/s");
+    add_result("net", 0, n_miners, n_workers, "solution_p50", stats_percentile(phases+PHASE_SEARCH, 0.50)/1e3, "us");
+    add_result("net", 0, n_miners, n_workers, "solution_p99", stats_percentile(phases+PHASE_SEARCH, 0.99)/1e3, "us");
+    add_result("net", 0, n_miners, n_workers, "voting_p50", stats_percentile(phases+PHASE_VOTING, 0.50)/1e3, "us");
+    add_result("net", 0, n_miners, n_workers, "voting_p99", stats_percentile(phases+PHASE_VOTING, 0.99)/1e3, "us");
+    add_result("net", 0, n_miners, n_workers, "update_p50", stats_percentile(phases+PHASE_UPDATE, 0.50)/1e3, "us");
+    add_result("net", 0, n_miners, n_workers, "update_p99", stats_percentile(phases+PHASE_UPDATE, 0.99)/1e3, "us");
+    add_result("net", 0, n_miners, n_workers, "updated_wait_p50", stats_percentile(phases+PHASE_UPDATED_WAIT, 0.50)/1e3, "us");
+    add_result("net", 0, n_miners, n_workers, "updated_wait_p99", stats_percentile(phases+PHASE_UPDATED_WAIT, 0.99)/1e3, "us");
+
+    return EXIT_SUCCESS;
+}
+
+
+
+
+/*******************
+ ** Main function **
+ *******************/
+
+int main(int argc, char **argv) {
+    int format = FORMAT_CSV, max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int n_workers = 1, n_rounds = 100, nets[MAX_NETS] = {1, 2, 4}, n_nets = 3;
+    char *backend_name = NULL, *miner_path = "./miner", *shard = NULL, *token;
+    double seconds = 1;
+    int opt, i;
+
+    while ((opt = getopt(argc, argv, "f:b:s:t:m:w:r:x:S:")) != -1) {
+        if (opt == 'f' && strcmp(optarg, "csv") == 0) format = FORMAT_CSV;
+        else if (opt == 'f' && strcmp(optarg, "json") == 0) format = FORMAT_JSON;
+        else if (opt == 'b') backend_name = optarg;
+        else if (opt == 's' && atof(optarg) > 0) seconds = atof(optarg);
+        else if (opt == 't' && atoi(optarg) >= 1 && atoi(optarg) <= MAX_THREADS) max_threads = atoi(optarg);
+        else if (opt == 'w' && atoi(optarg) >= 1 && atoi(optarg) <= MAX_WORKERS) n_workers = atoi(optarg);
+        else if (opt == 'r' && atoi(optarg) >= 1) n_rounds = atoi(optarg);
+        else if (opt == 'x') miner_path = optarg;
+        else if (opt == 'S') shard = optarg;
+        else if (opt == 'm') {
+            /* Comma separated net sizes, 0 for no nets */
+            for (n_nets=0, token=strtok(optarg, ","); token != NULL && n_nets < MAX_NETS; token=strtok(NULL, ",")) {
+                if (atoi(token) > 0) nets[n_nets++] = atoi(token);
+            }
+        }
+        else {
+            argc = 0; /* Print usage */
+            break;
+        }
+    }
+
+    if (argc == 0 || optind != argc) {
+        fprintf(stderr, "Error: invalid arguments\n");
+        fprintf(stdout, "Usage: %s [-f csv|json] [-b backend] [-s seconds] [-t max_threads] [-m miners,...] [-w workers] [-r rounds] [-x miner] [-S shard]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (max_threads < 1) max_threads = 1;
+    if (max_threads > MAX_THREADS) max_threads = MAX_THREADS;
+
+    /* The nets run in the shard, so benchmarks in different shards do not meet */
+    if (shard_setup(shard) != EXIT_SUCCESS) exit(EXIT_FAILURE);
+    setenv(SHARD_ENV, shard_name(), 1);
+
+    if (hash_setup(backend_name) != EXIT_SUCCESS) exit(EXIT_FAILURE);
+
+    bench_hash(seconds);
+    bench_hash_batch(seconds);
+    bench_kernels(backend_name, max_threads, seconds);
+
+    for (i=0; i<n_nets; i++) {
+        if (bench_net(miner_path, backend_name, nets[i], n_workers, n_rounds) != EXIT_SUCCESS) {
+            print_results(format);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    print_results(format);
+
+    exit(EXIT_SUCCESS);
+}
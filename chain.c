@@ -0,0 +1,654 @@
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "hash.h"
+#include "log.h"
+#include "chain.h"
+
+#define TRUE 1
+#define FALSE 0
+
+/* Blocks whose hashes a validator thread checks at once */
+#define CHECK_BATCH 1024
+
+/* Checkpoints are padded so records start 8 byte aligned */
+#define RECORD_SIZE(n_wallets) ((sizeof(ChainCheckpoint) + (size_t)(n_wallets)*sizeof(int) + 7) & ~(size_t)7)
+
+
+
+
+
+struct validator_args_struct {
+    const Chain *chain;
+    uint64_t start; /* Records [start, end) of the segment */
+    uint64_t end;
+    uint64_t bad; /* First invalid record, 0 if none */
+    uint64_t first_block; /* Offset of the first block, 0 if none */
+    int first_id;
+    uint64_t first_target;
+    int last_id;
+    uint64_t last_solution;
+    uint64_t head_checkpoint; /* Checkpoint before the first block, 0 if none */
+    uint64_t last_checkpoint; /* 0 if none */
+};
+
+static uint32_t crc_table[256];
+
+
+
+
+/***************
+ ** Checksums **
+ ***************/
+
+/* Private */
+void crc_init() {
+    uint32_t c;
+    int i, k;
+
+    if (crc_table[1] != 0) return;
+
+    for (i=0; i<256; i++) {
+        for (c=i, k=0; k<8; k++) c = (c & 1) ? (c >> 1) ^ 0x82F63B78 : c >> 1;
+        crc_table[i] = c;
+    }
+}
+
+/* Private. CRC-32C, continues crc over len more bytes */
+uint32_t crc32c(uint32_t crc, const void *data, size_t len) {
+    const unsigned char *p = data;
+
+    for (crc = ~crc; len > 0; len--) crc = crc_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+    return ~crc;
+}
+
+/* Checksum a record should have. Its size must be known to be within the chain */
+uint32_t chain_checksum(const ChainBlock *record) {
+    static const uint32_t zero = 0;
+    uint32_t crc;
+
+    crc_init();
+    crc = crc32c(0, record, offsetof(ChainBlock, checksum));
+    crc = crc32c(crc, &zero, sizeof(zero));
+    return crc32c(crc, &(record->id), record->size - offsetof(ChainBlock, id));
+}
+
+/* Private. Whether the record at offset is whole below end, of a known kind and not
+ * damaged */
+int record_ok(const ChainBlock *record, uint64_t offset, uint64_t end) {
+    const ChainCheckpoint *checkpoint = (const ChainCheckpoint*) record;
+
+    if (offset + sizeof(ChainCheckpoint) > end) return FALSE;
+
+    if (record->kind == CHAIN_BLOCK) {
+        if (record->size != sizeof(ChainBlock)) return FALSE;
+    }
+    else if (record->kind == CHAIN_CHECKPOINT) {
+        if (checkpoint->n_wallets < 0 || checkpoint->n_wallets > CHAIN_MAX_WALLETS
+            || record->size != RECORD_SIZE(checkpoint->n_wallets)) return FALSE;
+    }
+    else return FALSE;
+
+    return offset + record->size <= end && chain_checksum(record) == record->checksum;
+}
+
+
+
+
+/***********
+ ** Chain **
+ ***********/
+
+/* Private */
+int chain_map(Chain *chain) {
+
+    crc_init();
+
+    /* The whole reservation is mapped at once, so the chain never moves when it grows
+     * and one munmap releases it */
+    chain->header = mmap(NULL, CHAIN_MAX_SIZE, PROT_READ, MAP_SHARED | MAP_NORESERVE, chain->fd, 0);
+    if (chain->header == MAP_FAILED) {
+        perror("Error: could not map chain\nmmap");
+        chain->header = NULL;
+        return EXIT_FAILURE;
+    }
+    chain->size = CHAIN_MAX_SIZE;
+
+    /* The whole history is there from the start, nothing to replay */
+    chain->first = sizeof(ChainHeader);
+    chain->end = chain->header->size;
+
+    return EXIT_SUCCESS;
+}
+
+/* Private. Rebuilds the header of a reopened chain file from its records. Everything
+ * from the first torn or damaged record on is dropped and zeroed */
+int recover_chain(Chain *chain, uint64_t file_size) {
+    ChainHeader header = *(chain->header);
+    const ChainBlock *record, *last = NULL;
+    const ChainCheckpoint *checkpoint;
+    uint64_t offset, old_size = header.size;
+
+    header.n_blocks = 0;
+    header.last_block = 0;
+    header.last_checkpoint = 0;
+    header.max_wallets = 0;
+
+    for (offset = sizeof(ChainHeader); ; offset += record->size) {
+        record = (const ChainBlock*)((const char*)chain->header + offset);
+        checkpoint = (const ChainCheckpoint*) record;
+
+        if (!record_ok(record, offset, file_size)) break;
+        if (record->kind == CHAIN_BLOCK && last != NULL && record->id != last->id + 1) break;
+        if (record->kind == CHAIN_CHECKPOINT && checkpoint->prev != header.last_checkpoint) break;
+
+        if (record->kind == CHAIN_BLOCK) {
+            last = record;
+            header.last_block = offset;
+            header.n_blocks++;
+        }
+        else {
+            header.last_checkpoint = offset;
+            if ((uint32_t)checkpoint->n_wallets > header.max_wallets) header.max_wallets = checkpoint->n_wallets;
+        }
+    }
+
+    header.size = offset;
+    for (header.capacity = CHAIN_GROW_SIZE; header.capacity < offset; header.capacity += CHAIN_GROW_SIZE);
+
+    /* Truncating first zeroes whatever a crash left past the last good record */
+    if (ftruncate(chain->fd, header.size) == -1 || ftruncate(chain->fd, header.capacity) == -1
+        || pwrite(chain->fd, &header, sizeof(header), 0) != sizeof(header)) {
+        perror("Error: could not recover chain file\nftruncate");
+        return EXIT_FAILURE;
+    }
+
+    if (header.size < old_size) log_info("Dropped %" PRIu64 " bytes of damaged chain tail\n", old_size - header.size);
+    log_debug("Resuming chain with %" PRIu64 " blocks\n", header.n_blocks);
+    chain->end = header.size;
+
+    return EXIT_SUCCESS;
+}
+
+/* Creates the net's chain. On shared memory it must not exist. A chain file is kept
+ * when the net ends and resumed by the next one */
+int chain_create(Chain *chain, const char *name, int is_shm, const char *backend) {
+    ChainHeader header;
+    struct stat st;
+
+    chain->header = NULL;
+    chain->is_shm = is_shm;
+
+    if (is_shm) chain->fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR);
+    else chain->fd = open(name, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+
+    if (chain->fd == -1) {
+        if (errno == EEXIST) {
+            fprintf(stderr, "Error: chain shared memory segment already exists\n");
+        }
+        else {
+            perror("Error: could not create chain\nopen");
+        }
+
+        return EXIT_FAILURE;
+    }
+
+    if (fstat(chain->fd, &st) == -1) {
+        perror("Error: could not stat chain\nfstat");
+        close(chain->fd);
+        if (is_shm) shm_unlink(name);
+        return EXIT_FAILURE;
+    }
+
+    if (st.st_size == 0) {
+        memset(&header, 0, sizeof(header));
+        header.magic = CHAIN_MAGIC;
+        header.version = CHAIN_VERSION;
+        header.nonce = ((uint64_t)time(NULL) << 32) ^ ((uint64_t)getpid() << 16) ^ (uint64_t)clock();
+        strncpy(header.backend, backend, sizeof(header.backend)-1);
+        header.size = sizeof(ChainHeader);
+        header.capacity = CHAIN_GROW_SIZE;
+
+        if (ftruncate(chain->fd, CHAIN_GROW_SIZE) == -1
+            || pwrite(chain->fd, &header, sizeof(header), 0) != sizeof(header)) {
+            perror("Error: could not initialize chain\nftruncate");
+            close(chain->fd);
+            if (is_shm) shm_unlink(name);
+            return EXIT_FAILURE;
+        }
+
+        if (chain_map(chain) != EXIT_SUCCESS) {
+            close(chain->fd);
+            if (is_shm) shm_unlink(name);
+            return EXIT_FAILURE;
+        }
+
+        return EXIT_SUCCESS;
+    }
+
+    if (chain_map(chain) != EXIT_SUCCESS) {
+        close(chain->fd);
+        return EXIT_FAILURE;
+    }
+
+    if ((size_t)st.st_size < sizeof(ChainHeader) || chain->header->magic != CHAIN_MAGIC || chain->header->version != CHAIN_VERSION) {
+        fprintf(stderr, "Error: %s is not a chain file of version %d\n", name, CHAIN_VERSION);
+        chain_close(chain);
+        return EXIT_FAILURE;
+    }
+
+    if (strncmp(chain->header->backend, backend, sizeof(chain->header->backend)) != 0) {
+        fprintf(stderr, "Error: chain %s was mined with hash backend %.16s\n", name, chain->header->backend);
+        chain_close(chain);
+        return EXIT_FAILURE;
+    }
+
+    if (recover_chain(chain, st.st_size) != EXIT_SUCCESS) {
+        chain_close(chain);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/* Maps the chain of a running net, in O(1) whatever its length */
+int chain_open(Chain *chain, const char *name, int is_shm) {
+
+    chain->header = NULL;
+    chain->is_shm = is_shm;
+
+    if (is_shm) chain->fd = shm_open(name, O_RDWR, 0);
+    else chain->fd = open(name, O_RDWR);
+
+    if (chain->fd == -1) {
+        perror("Error: could not open existing chain\nopen");
+        return EXIT_FAILURE;
+    }
+
+    if (chain_map(chain) != EXIT_SUCCESS) {
+        close(chain->fd);
+        return EXIT_FAILURE;
+    }
+
+    if (chain->header->magic != CHAIN_MAGIC) {
+        fprintf(stderr, "Error: %s is not a chain\n", name);
+        chain_close(chain);
+        return EXIT_FAILURE;
+    }
+
+    /* Readers size their wallet buffers after it */
+    if (chain->header->max_wallets > CHAIN_MAX_WALLETS) {
+        fprintf(stderr, "Error: chain %s is damaged, %u wallets in a checkpoint\n", name, chain->header->max_wallets);
+        chain_close(chain);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/* Makes room for bytes more, growing the segment by whole CHAIN_GROW_SIZE steps.
+ * Meant to be called by the next miner to append before it takes the lock that
+ * serializes appends, nobody else may append meanwhile */
+int chain_reserve(Chain *chain, size_t bytes) {
+    uint64_t capacity = chain->header->capacity;
+
+    if (chain->header->size + bytes <= capacity) return EXIT_SUCCESS;
+
+    while (chain->header->size + bytes > capacity) capacity += CHAIN_GROW_SIZE;
+    if (capacity > chain->size) {
+        fprintf(stderr, "Error: chain is full\n");
+        return EXIT_FAILURE;
+    }
+
+    if (ftruncate(chain->fd, capacity) == -1) {
+        perror("Error: could not grow chain\nftruncate");
+        return EXIT_FAILURE;
+    }
+
+    /* Readers never look at the capacity, only appends do */
+    if (pwrite(chain->fd, &capacity, sizeof(capacity), offsetof(ChainHeader, capacity)) != sizeof(capacity)) {
+        perror("Error: could not grow chain\npwrite");
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/* Private. Appends must be serialized by the caller, readers only look at records
+ * below the size they read while serialized with it */
+int append_record(Chain *chain, struct iovec *iov, int n_iov, size_t size, const ChainCheckpoint *checkpoint) {
+    ChainHeader header;
+    uint32_t crc;
+    int i;
+
+    /* The checksum field is still 0 in the first iovec */
+    for (i=0, crc=0; i<n_iov; i++) crc = crc32c(crc, iov[i].iov_base, iov[i].iov_len);
+    ((ChainBlock*)iov[0].iov_base)->checksum = crc;
+
+    /* Normally reserved beforehand, outside the lock */
+    if (chain_reserve(chain, size) != EXIT_SUCCESS) return EXIT_FAILURE;
+    header = *(chain->header);
+
+    if (pwritev(chain->fd, iov, n_iov, header.size) != (ssize_t)size) {
+        perror("Error: could not append record to chain\npwritev");
+        return EXIT_FAILURE;
+    }
+
+    /* The record only becomes part of the chain once the header counts it */
+    if (checkpoint != NULL) {
+        header.last_checkpoint = header.size;
+        if ((uint32_t)checkpoint->n_wallets > header.max_wallets) header.max_wallets = checkpoint->n_wallets;
+    }
+    else {
+        header.last_block = header.size;
+        header.n_blocks++;
+    }
+    header.size += size;
+    if (pwrite(chain->fd, &header, sizeof(header), 0) != sizeof(header)) {
+        perror("Error: could not append record to chain\npwrite");
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int chain_append_block(Chain *chain, int id, int winner, int delta, uint64_t target, uint64_t solution) {
+    ChainBlock block;
+    struct iovec iov;
+
+    block.size = sizeof(block);
+    block.kind = CHAIN_BLOCK;
+    block.delta = delta;
+    block.checksum = 0;
+    block.id = id;
+    block.winner = winner;
+    block.reserved = 0;
+    block.target = target;
+    block.solution = solution;
+
+    iov.iov_base = &block;
+    iov.iov_len = sizeof(block);
+
+    return append_record(chain, &iov, 1, sizeof(block), NULL);
+}
+
+int chain_append_checkpoint(Chain *chain, int id, const int *wallets, int n_wallets) {
+    static const char padding[8];
+    ChainCheckpoint checkpoint;
+    struct iovec iov[3];
+    size_t size = RECORD_SIZE(n_wallets);
+
+    checkpoint.size = size;
+    checkpoint.kind = CHAIN_CHECKPOINT;
+    checkpoint.reserved = 0;
+    checkpoint.checksum = 0;
+    checkpoint.id = id;
+    checkpoint.n_wallets = n_wallets;
+    checkpoint.reserved2 = 0;
+    checkpoint.prev = chain->header->last_checkpoint;
+
+    iov[0].iov_base = &checkpoint;
+    iov[0].iov_len = sizeof(checkpoint);
+    iov[1].iov_base = (void*)wallets;
+    iov[1].iov_len = n_wallets*sizeof(int);
+    iov[2].iov_base = (void*)padding;
+    iov[2].iov_len = size - sizeof(checkpoint) - n_wallets*sizeof(int);
+
+    return append_record(chain, iov, 3, size, &checkpoint);
+}
+
+/* Record at offset, NULL past the end of the chain. Its kind tells whether it is a
+ * ChainBlock or a ChainCheckpoint */
+const ChainBlock *chain_record(const Chain *chain, uint64_t offset) {
+    if (offset >= chain->header->size) return NULL;
+    return (const ChainBlock*)((const char*)chain->header + offset);
+}
+
+/* Returns the number of wallets copied */
+int chain_load_checkpoint(const ChainCheckpoint *checkpoint, int *wallets, int max_wallets) {
+    int n = (checkpoint->n_wallets < max_wallets) ? checkpoint->n_wallets : max_wallets;
+
+    memcpy(wallets, checkpoint->wallets, n*sizeof(int));
+
+    return n;
+}
+
+/* Balances after block height: the last checkpoint at or below it plus the deltas of
+ * the blocks after it. Wallets the checkpoint lacks stay -1, their miners joined
+ * since. Returns the number of wallets, -1 if no checkpoint covers it */
+int chain_snapshot(const Chain *chain, int height, int *wallets, int max_wallets) {
+    const ChainCheckpoint *checkpoint;
+    const ChainBlock *record;
+    uint64_t offset;
+    int n;
+
+    for (offset = chain->header->last_checkpoint; offset != 0; offset = checkpoint->prev) {
+        checkpoint = (const ChainCheckpoint*) chain_record(chain, offset);
+        if (checkpoint == NULL) return -1;
+        if (checkpoint->id <= height) break;
+    }
+    if (offset == 0) return -1;
+
+    n = chain_load_checkpoint(checkpoint, wallets, max_wallets);
+
+    for (offset += checkpoint->size; (record = chain_record(chain, offset)) != NULL && record->id <= height; offset += record->size) {
+        if (record->kind == CHAIN_BLOCK && record->winner < n && wallets[record->winner] != -1) wallets[record->winner] += record->delta;
+    }
+
+    return n;
+}
+
+
+
+
+
+/****************
+ ** Validation **
+ ****************/
+
+void chain_check_init(ChainCheck *check) {
+    check->nonce = 0;
+    check->end = sizeof(ChainHeader);
+    check->id = 0;
+    check->solution = UINT64_MAX;
+    check->checkpoint = 0;
+    check->bad = 0;
+}
+
+/* Private. Checks the hashes of a batch, keeping the first mismatch as bad */
+void check_batch(struct validator_args_struct *args, const uint64_t *solutions, const uint64_t *targets, const uint64_t *offsets, int n) {
+    uint64_t hashes[CHECK_BATCH];
+    int i;
+
+    hash_batch(solutions, hashes, n);
+    for (i=0; i<n; i++) {
+        if (hashes[i] != targets[i]) {
+            if (args->bad == 0 || offsets[i] < args->bad) args->bad = offsets[i];
+            return;
+        }
+    }
+}
+
+/* Private. Validates the records of a segment on their own. How they link to the
+ * segment before is checked when the segments are put together */
+void *validator_main_loop(struct validator_args_struct *args) {
+    const ChainBlock *record;
+    const ChainCheckpoint *checkpoint;
+    uint64_t solutions[CHECK_BATCH], targets[CHECK_BATCH], offsets[CHECK_BATCH];
+    uint64_t offset, modulus = hash_keyspace();
+    int n = 0;
+
+    args->bad = 0;
+    args->first_block = 0;
+    args->head_checkpoint = 0;
+    args->last_checkpoint = 0;
+
+    for (offset = args->start; offset < args->end; offset += record->size) {
+        record = (const ChainBlock*)((const char*)args->chain->header + offset);
+        checkpoint = (const ChainCheckpoint*) record;
+
+        if (!record_ok(record, offset, args->end)) break;
+
+        if (record->kind == CHAIN_CHECKPOINT) {
+            /* Written right after the block it follows */
+            if (args->first_block != 0 && checkpoint->id != args->last_id) break;
+            if (args->last_checkpoint != 0 && checkpoint->prev != args->last_checkpoint) break;
+            if (checkpoint->prev >= offset) break;
+            if (args->first_block == 0) args->head_checkpoint = offset;
+            args->last_checkpoint = offset;
+            continue;
+        }
+
+        if (args->first_block != 0 && (record->id != args->last_id + 1 || record->target != args->last_solution)) break;
+        if (record->solution >= modulus) break;
+
+        if (args->first_block == 0) {
+            args->first_block = offset;
+            args->first_id = record->id;
+            args->first_target = record->target;
+        }
+        args->last_id = record->id;
+        args->last_solution = record->solution;
+
+        solutions[n] = record->solution;
+        targets[n] = record->target;
+        offsets[n] = offset;
+        if (++n == CHECK_BATCH) {
+            check_batch(args, solutions, targets, offsets, n);
+            if (args->bad != 0) break;
+            n = 0;
+        }
+    }
+
+    if (offset < args->end && (args->bad == 0 || offset < args->bad)) args->bad = offset;
+    if (n > 0) check_batch(args, solutions, targets, offsets, n);
+
+    pthread_exit(NULL);
+}
+
+/* Private. Splits [start, end) at checkpoints in up to n_segments segments of about
+ * the same number of checkpoints. Returns the number of segments */
+int split_chain(const Chain *chain, uint64_t start, uint64_t end, uint64_t *bounds, int n_segments) {
+    uint64_t offset, prev, *checkpoints;
+    long n, i;
+    int k;
+
+    /* Walked backwards from the last one, they link to each other */
+    for (n=0, offset=chain->header->last_checkpoint; offset > start; offset = prev, n++) {
+        prev = ((const ChainCheckpoint*) chain_record(chain, offset))->prev;
+        if (prev >= offset) break;
+    }
+
+    bounds[0] = start;
+    checkpoints = (n > 0) ? malloc(n*sizeof(uint64_t)) : NULL;
+    if (checkpoints == NULL) {
+        bounds[1] = end;
+        return 1;
+    }
+
+    for (i=n-1, offset=chain->header->last_checkpoint; i >= 0; offset = ((const ChainCheckpoint*) chain_record(chain, offset))->prev, i--) {
+        checkpoints[i] = offset;
+    }
+
+    /* Checkpoints at or past end were appended after it */
+    while (n > 0 && checkpoints[n-1] >= end) n--;
+    if (n_segments > n + 1) n_segments = n + 1;
+
+    for (k=1; k<n_segments; k++) bounds[k] = checkpoints[(n*k)/n_segments];
+    bounds[n_segments] = end;
+    free(checkpoints);
+
+    return n_segments;
+}
+
+/* Validates the records in [check->end, end) with n_threads threads: every record
+ * is whole and undamaged, every block follows the one before it (consecutive id,
+ * target is the previous solution) and hashes its solution to its target, and every
+ * checkpoint follows its block and links to the one before. The hash backend must
+ * be the chain's. A check of another chain, or of a chain recreated since, starts
+ * over from the beginning.
+ * On success check moves to end, so a later call validates only what was appended.
+ * Otherwise check->bad is the offset of the first invalid record */
+int chain_validate(const Chain *chain, ChainCheck *check, uint64_t end, int n_threads) {
+    uint64_t bounds[n_threads+1];
+    struct validator_args_struct v_args[n_threads];
+    pthread_t threads[n_threads];
+    struct validator_args_struct *seg;
+    int i, n, error;
+
+    if (check->nonce != chain->header->nonce) {
+        chain_check_init(check);
+        check->nonce = chain->header->nonce;
+    }
+    check->bad = 0;
+    if (end > chain->header->size) end = chain->header->size;
+    if (end <= check->end) return EXIT_SUCCESS;
+
+    n = split_chain(chain, check->end, end, bounds, n_threads);
+
+    for (i=0; i<n; i++) {
+        v_args[i].chain = chain;
+        v_args[i].start = bounds[i];
+        v_args[i].end = bounds[i+1];
+        error = pthread_create(threads+i, NULL, (void*) validator_main_loop, v_args+i);
+        if (error != 0) {
+            fprintf(stderr, "Error: could not start chain validator\npthread_create: %s\n", strerror(error));
+            for (i--; i>=0; i--) pthread_join(threads[i], NULL);
+            return EXIT_FAILURE;
+        }
+    }
+    for (i=0; i<n; i++) pthread_join(threads[i], NULL);
+
+    /* Put the segments together, in order */
+    for (i=0; i<n; i++) {
+        seg = v_args + i;
+
+        if (seg->head_checkpoint != 0) {
+            const ChainCheckpoint *checkpoint = (const ChainCheckpoint*) chain_record(chain, seg->head_checkpoint);
+            if (checkpoint->id != check->id || checkpoint->prev != check->checkpoint) {
+                check->bad = seg->head_checkpoint;
+                return EXIT_FAILURE;
+            }
+        }
+        if (seg->first_block != 0 && check->id != 0
+            && (seg->first_id != check->id + 1 || seg->first_target != check->solution)) {
+            check->bad = seg->first_block;
+            return EXIT_FAILURE;
+        }
+        if (seg->bad != 0) {
+            check->bad = seg->bad;
+            return EXIT_FAILURE;
+        }
+
+        if (seg->first_block != 0) {
+            check->id = seg->last_id;
+            check->solution = seg->last_solution;
+        }
+        if (seg->last_checkpoint != 0) check->checkpoint = seg->last_checkpoint;
+    }
+
+    check->end = end;
+
+    return EXIT_SUCCESS;
+}
+
+void chain_close(Chain *chain) {
+    if (chain->header != NULL) {
+        /* Appends are not synced one by one, a crash loses at most a torn tail */
+        if (!chain->is_shm) fdatasync(chain->fd);
+        munmap((void*)chain->header, chain->size);
+        close(chain->fd);
+    }
+    chain->header = NULL;
+    chain->size = 0;
+}
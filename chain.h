@@ -0,0 +1,100 @@
+#include <stdint.h>
+#include <stddef.h>
+
+#define CHAIN_MAGIC 0x4e494843 /* "CHIN" */
+#define CHAIN_VERSION 2
+
+/* The chain grows by this many bytes at a time, about 26k blocks */
+#define CHAIN_GROW_SIZE (1<<20)
+
+/* Address space every miner reserves for the chain, mapped once. Only the pages
+ * below the chain's size are ever touched */
+#define CHAIN_MAX_SIZE (1UL<<34)
+
+/* Wallets in a checkpoint, at most: a miner is a process, and pids are below 2^22.
+ * Larger counts read from a chain are taken as damage */
+#define CHAIN_MAX_WALLETS (1<<22)
+
+/* Record kinds */
+#define CHAIN_BLOCK 1
+#define CHAIN_CHECKPOINT 2
+
+/* Blocks between two checkpoints, at most. Also written when miners join or leave */
+#define CHAIN_CHECKPOINT_EVERY 64
+
+/* When a chain file is reopened only magic, version and backend are trusted, the
+ * rest is rebuilt from the records */
+typedef struct _ChainHeader {
+    uint32_t magic;
+    uint32_t version;
+    char backend[16]; /* Hash backend of the net that mined it */
+    uint64_t nonce; /* Random, tells a chain from one created later under the same name */
+    uint64_t size; /* Bytes used, header included */
+    uint64_t capacity; /* Bytes in the chain, a multiple of CHAIN_GROW_SIZE */
+    uint64_t n_blocks;
+    uint64_t last_block; /* Offset of the last block, 0 if none */
+    uint64_t last_checkpoint; /* Offset of the last checkpoint, 0 if none */
+    uint32_t max_wallets; /* Wallets in the largest checkpoint */
+    uint32_t reserved;
+} ChainHeader;
+
+/* A block as recorded in the chain. Every record starts with size, kind, checksum
+ * and id, so records of any kind are walked as ChainBlocks */
+typedef struct _ChainBlock {
+    uint32_t size; /* Bytes of the record */
+    uint16_t kind; /* CHAIN_BLOCK */
+    int16_t delta; /* Coins credited to the winner */
+    uint32_t checksum; /* CRC-32C of the record, taken with this field as 0 */
+    int id;
+    int winner; /* Miner index */
+    uint32_t reserved;
+    uint64_t target;
+    uint64_t solution;
+} ChainBlock;
+
+/* Full balances after block id, written after it */
+typedef struct _ChainCheckpoint {
+    uint32_t size; /* Bytes of the record, wallets and padding included */
+    uint16_t kind; /* CHAIN_CHECKPOINT */
+    uint16_t reserved;
+    uint32_t checksum;
+    int id;
+    int n_wallets;
+    uint32_t reserved2;
+    uint64_t prev; /* Offset of the previous checkpoint, 0 if none */
+    int wallets[]; /* Coins of each miner index, -1 if none */
+} ChainCheckpoint;
+
+/* The net's chain, shared by every miner on shared memory or in a file. Blocks are
+ * appended once, by the winner, and never change afterwards */
+typedef struct _Chain {
+    const ChainHeader *header; /* Mapped read-only, NULL if not mapped */
+    size_t size; /* Bytes mapped, CHAIN_MAX_SIZE */
+    int fd; /* Appends are written through it */
+    int is_shm;
+    uint64_t first; /* Offset of the first block to print */
+    uint64_t end; /* Offset past the last block this miner saw recorded */
+} Chain;
+
+/* How far a chain has been validated, see chain_validate */
+typedef struct _ChainCheck {
+    uint64_t nonce; /* Chain it belongs to */
+    uint64_t end; /* Records below it are valid */
+    int id; /* Last valid block, 0 if none */
+    uint64_t solution;
+    uint64_t checkpoint; /* Last valid checkpoint, 0 if none */
+    uint64_t bad; /* First invalid record found, 0 if none */
+} ChainCheck;
+
+int chain_create(Chain *chain, const char *name, int is_shm, const char *backend);
+int chain_open(Chain *chain, const char *name, int is_shm);
+int chain_reserve(Chain *chain, size_t bytes);
+int chain_append_block(Chain *chain, int id, int winner, int delta, uint64_t target, uint64_t solution);
+int chain_append_checkpoint(Chain *chain, int id, const int *wallets, int n_wallets);
+const ChainBlock *chain_record(const Chain *chain, uint64_t offset);
+uint32_t chain_checksum(const ChainBlock *record);
+int chain_load_checkpoint(const ChainCheckpoint *checkpoint, int *wallets, int max_wallets);
+int chain_snapshot(const Chain *chain, int height, int *wallets, int max_wallets);
+void chain_check_init(ChainCheck *check);
+int chain_validate(const Chain *chain, ChainCheck *check, uint64_t end, int n_threads);
+void chain_close(Chain *chain);
@@ -0,0 +1,430 @@
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "miner.h"
+#include "stats.h"
+#include "shard.h"
+
+#define TRUE 1
+#define FALSE 0
+
+#define MAX_MINERS 4096
+
+/* Main loop period */
+#define TICK_NS 1000000UL
+
+/* Miner states */
+#define CHILD_JOINING 0 /* Spawned, not seen in the stats yet */
+#define CHILD_MINING 1
+#define CHILD_LEAVING 2 /* Sent SIGINT */
+#define CHILD_KILLED 3 /* Sent SIGKILL */
+#define CHILD_DONE 4
+
+
+struct child_struct {
+    pid_t pid;
+    int state;
+    uint64_t spawned; /* ns */
+};
+
+struct churn_struct {
+    /* Options */
+    int population; /* Miners kept running */
+    double rate; /* Miners replaced per second */
+    double kill_ratio; /* Of those replaced, killed with SIGKILL rather than SIGINT */
+    double duration; /* s */
+    int n_workers;
+    double hang_timeout; /* s without a new block, with miners running, is a hang */
+    double stall_ms; /* Rounds longer than this are stalled */
+    char *miner_path;
+    /* Miners */
+    struct child_struct children[MAX_MINERS];
+    int n_children;
+    int live; /* Not done */
+    /* Net being watched, remapped when a new one starts */
+    NetData *net;
+    Block *block;
+    int last_id;
+    uint64_t last_change; /* ns */
+    /* Figures */
+    Stats stats;
+    Histogram join_latency;
+    Histogram round_latency;
+    uint64_t spawned, joined, interrupted, killed, clean_exits, failed_exits, rounds, stalled, hangs;
+};
+
+
+
+
+/**********************
+ ** Global variables **
+ **********************/
+static volatile sig_atomic_t active = TRUE;
+
+
+
+
+/*********************
+ ** Signal handlers **
+ *********************/
+void sigint_handler(int sig) {
+    (void) sig;
+    active = FALSE;
+}
+
+
+
+
+/***********
+ ** Miners **
+ ***********/
+
+/* Private */
+int spawn_miner(struct churn_struct *churn) {
+    struct child_struct *child;
+    char workers_str[16];
+    pid_t pid;
+
+    if (churn->n_children == MAX_MINERS) return EXIT_FAILURE;
+
+    snprintf(workers_str, sizeof(workers_str), "%d", churn->n_workers);
+
+    if ((pid = fork()) == -1) {
+        perror("Error: could not start miner\nfork");
+        return EXIT_FAILURE;
+    }
+    if (pid == 0) {
+        freopen("/dev/null", "w", stdout);
+        execl(churn->miner_path, churn->miner_path, "-q", workers_str, "0", (char*) NULL);
+        perror("Error: could not run miner\nexecl");
+        _exit(EXIT_FAILURE);
+    }
+
+    child = churn->children + churn->n_children++;
+    child->pid = pid;
+    child->state = CHILD_JOINING;
+    child->spawned = stats_now();
+    churn->live++;
+    churn->spawned++;
+
+    return EXIT_SUCCESS;
+}
+
+/* Private. Stops a random miner, with SIGKILL kill_ratio of the times */
+void stop_miner(struct churn_struct *churn) {
+    struct child_struct *child;
+    int i, k, n = 0;
+
+    for (i=0; i<churn->n_children; i++) n += (churn->children[i].state == CHILD_MINING);
+    if (n == 0) return;
+
+    for (i=0, k=rand()%n; ; i++) {
+        if (churn->children[i].state == CHILD_MINING && k-- == 0) break;
+    }
+    child = churn->children + i;
+
+    if ((double)rand()/RAND_MAX < churn->kill_ratio) {
+        kill(child->pid, SIGKILL);
+        child->state = CHILD_KILLED;
+        churn->killed++;
+    }
+    else {
+        kill(child->pid, SIGINT);
+        child->state = CHILD_LEAVING;
+        churn->interrupted++;
+    }
+}
+
+/* Private. Reaps the miners that ended */
+void reap_miners(struct churn_struct *churn) {
+    pid_t pid;
+    int i, j, status;
+
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        for (i=0; i<churn->n_children && churn->children[i].pid != pid; i++);
+        if (i == churn->n_children || churn->children[i].state == CHILD_DONE) continue;
+
+        if (churn->children[i].state != CHILD_KILLED) {
+            if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS) churn->clean_exits++;
+            else churn->failed_exits++;
+        }
+        churn->children[i].state = CHILD_DONE;
+        churn->live--;
+    }
+
+    /* Compacted once most entries are done, so the array never runs out */
+    if (churn->n_children > MAX_MINERS/2 && churn->live < MAX_MINERS/4) {
+        for (i=0, j=0; i<churn->n_children; i++) {
+            if (churn->children[i].state != CHILD_DONE) churn->children[j++] = churn->children[i];
+        }
+        churn->n_children = j;
+    }
+}
+
+/* Private. A miner has joined once its stats slot is attached, at its first round */
+void find_joined(struct churn_struct *churn) {
+    int pending[MAX_MINERS];
+    int i, j, n = 0;
+    pid_t pid;
+
+    if (churn->stats.header == NULL) return;
+    for (i=0; i<churn->n_children; i++) {
+        if (churn->children[i].state == CHILD_JOINING) pending[n++] = i;
+    }
+
+    for (j=0; j<STATS_MAX_MINERS && n > 0; j++) {
+        if ((pid = __atomic_load_n(&(churn->stats.miners[j].pid), __ATOMIC_ACQUIRE)) == 0) continue;
+        for (i=0; i<n && churn->children[pending[i]].pid != pid; i++);
+        if (i == n) continue;
+
+        churn->children[pending[i]].state = CHILD_MINING;
+        stats_record(&(churn->join_latency), stats_now() - churn->children[pending[i]].spawned);
+        churn->joined++;
+        pending[i] = pending[--n];
+    }
+}
+
+
+
+
+/*********
+ ** Net **
+ *********/
+
+/* Private. Maps a segment read-only, once it has its full size */
+void *map_segment(const char *name, size_t size) {
+    struct stat st;
+    void *p;
+    int fd;
+
+    if ((fd = shm_open(name, O_RDONLY, 0)) == -1) return NULL;
+    if (fstat(fd, &st) == -1 || st.st_size < (off_t) size) {
+        close(fd);
+        return NULL;
+    }
+    p = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    return (p == MAP_FAILED) ? NULL : p;
+}
+
+/* Private. Follows the running net, and the next one once it closes */
+void watch_net(struct churn_struct *churn) {
+    uint64_t now = stats_now();
+    int id, fd;
+
+    if (churn->net != NULL && churn->net->closed) {
+        munmap(churn->net, sizeof(NetData));
+        if (churn->block != NULL) munmap(churn->block, sizeof(Block));
+        stats_close(&(churn->stats));
+        churn->net = NULL;
+        churn->block = NULL;
+    }
+
+    if (churn->net == NULL) {
+        if ((churn->net = map_segment(shard_shm(SHM_NAME_NET), sizeof(NetData))) == NULL) return;
+        if (!__atomic_load_n(&(churn->net->ready), __ATOMIC_ACQUIRE) || (churn->block = map_segment(shard_shm(SHM_NAME_BLOCK), sizeof(Block))) == NULL) {
+            munmap(churn->net, sizeof(NetData));
+            churn->net = NULL;
+            return;
+        }
+        churn->last_id = churn->block->id;
+        churn->last_change = now;
+    }
+
+    /* Created by the first miner after the net, retried until it is ready */
+    if (churn->stats.header == NULL && (fd = shm_open(shard_shm(SHM_NAME_STATS), O_RDONLY, 0)) != -1) {
+        close(fd);
+        if (stats_open(&(churn->stats), FALSE) != EXIT_SUCCESS) churn->stats.header = NULL;
+    }
+
+    id = __atomic_load_n(&(churn->block->id), __ATOMIC_ACQUIRE);
+    if (id != churn->last_id) {
+        stats_record(&(churn->round_latency), now - churn->last_change);
+        if (now - churn->last_change > churn->stall_ms*1e6) churn->stalled++;
+        churn->rounds += (id > churn->last_id) ? id - churn->last_id : 1;
+        churn->last_id = id;
+        churn->last_change = now;
+    }
+}
+
+/* Private. What a hung net looks like */
+void report_hang(struct churn_struct *churn) {
+    fprintf(stderr, "Error: no block for %.1fs with %d miners running", churn->hang_timeout, churn->live);
+    if (churn->net != NULL) {
+        fprintf(stderr, " (block %d, net has %d miners, winner %d, epoch %u)",
+            churn->block->id, churn->net->total_miners, churn->net->current_winner, churn->net->round_epoch);
+    }
+    fprintf(stderr, "\n");
+}
+
+
+
+
+/*************
+ ** Results **
+ *************/
+
+/* Private */
+void print_results(struct churn_struct *churn, double seconds) {
+    printf("metric,value,unit\n");
+    printf("duration,%.3f,s\n", seconds);
+    printf("spawned,%" PRIu64 ",miners\n", churn->spawned);
+    printf("joined,%" PRIu64 ",miners\n", churn->joined);
+    printf("interrupted,%" PRIu64 ",miners\n", churn->interrupted);
+    printf("killed,%" PRIu64 ",miners\n", churn->killed);
+    printf("clean_exits,%" PRIu64 ",miners\n", churn->clean_exits);
+    printf("failed_exits,%" PRIu64 ",miners\n", churn->failed_exits);
+    printf("join_p50,%.3f,ms\n", stats_percentile(&(churn->join_latency), 0.50)/1e6);
+    printf("join_p99,%.3f,ms\n", stats_percentile(&(churn->join_latency), 0.99)/1e6);
+    printf("join_max,%.3f,ms\n", churn->join_latency.max/1e6);
+    printf("rounds,%" PRIu64 ",rounds\n", churn->rounds);
+    printf("rounds_per_s,%.3f,round/s\n", churn->rounds/seconds);
+    printf("round_p50,%.3f,ms\n", stats_percentile(&(churn->round_latency), 0.50)/1e6);
+    printf("round_p99,%.3f,ms\n", stats_percentile(&(churn->round_latency), 0.99)/1e6);
+    printf("round_max,%.3f,ms\n", churn->round_latency.max/1e6);
+    printf("stalled_rounds,%" PRIu64 ",rounds\n", churn->stalled);
+    printf("hangs,%" PRIu64 ",hangs\n", churn->hangs);
+    fflush(stdout);
+}
+
+
+
+
+/*******************
+ ** Main function **
+ *******************/
+
+/* Keeps population miners running and replaces rate of them per second, killing
+ * kill_ratio of those with SIGKILL. Ends after duration, or at the first hang */
+int main(int argc, char **argv) {
+    static struct churn_struct churn;
+    struct sigaction act;
+    struct timespec tick = {0, TICK_NS};
+    uint64_t start, now, next_change, deadline, stop_deadline;
+    char *shard;
+    int opt, i, fd;
+
+    churn.population = 50;
+    churn.rate = 10;
+    churn.kill_ratio = 0;
+    churn.duration = 30;
+    churn.n_workers = 1;
+    churn.hang_timeout = 10;
+    churn.stall_ms = 500;
+    churn.miner_path = "./miner";
+    shard = NULL;
+
+    while ((opt = getopt(argc, argv, "n:r:k:d:w:H:s:x:S:")) != -1) {
+        if (opt == 'n' && atoi(optarg) >= 1 && atoi(optarg) <= MAX_MINERS/4) churn.population = atoi(optarg);
+        else if (opt == 'r' && atof(optarg) >= 0) churn.rate = atof(optarg);
+        else if (opt == 'k' && atof(optarg) >= 0 && atof(optarg) <= 1) churn.kill_ratio = atof(optarg);
+        else if (opt == 'd' && atof(optarg) > 0) churn.duration = atof(optarg);
+        else if (opt == 'w' && atoi(optarg) >= 1 && atoi(optarg) <= MAX_WORKERS) churn.n_workers = atoi(optarg);
+        else if (opt == 'H' && atof(optarg) > 0) churn.hang_timeout = atof(optarg);
+        else if (opt == 's' && atof(optarg) > 0) churn.stall_ms = atof(optarg);
+        else if (opt == 'x') churn.miner_path = optarg;
+        else if (opt == 'S') shard = optarg;
+        else {
+            argc = 0; /* Print usage */
+            break;
+        }
+    }
+
+    if (argc == 0 || optind != argc) {
+        fprintf(stderr, "Error: invalid arguments\n");
+        fprintf(stdout, "Usage: %s [-n miners] [-r replaced_per_s] [-k kill_ratio] [-d seconds] [-w workers] [-H hang_s] [-s stall_ms] [-x miner] [-S shard]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    /* The miners started inherit the shard */
+    if (shard_setup(shard) != EXIT_SUCCESS) exit(EXIT_FAILURE);
+    setenv(SHARD_ENV, shard_name(), 1);
+
+    if ((fd = shm_open(shard_shm(SHM_NAME_NET), O_RDONLY, 0)) != -1) {
+        close(fd);
+        fprintf(stderr, "Error: a net is already running in this shard\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* SIGINT ends the run early, the miners are stopped the usual way */
+    act.sa_handler = sigint_handler;
+    sigemptyset(&(act.sa_mask));
+    act.sa_flags = 0;
+    sigaction(SIGINT, &act, NULL);
+
+    srand(time(NULL) ^ getpid());
+    churn.stats.header = NULL;
+
+    start = stats_now();
+    deadline = start + churn.duration*1e9;
+    next_change = start;
+    churn.last_change = start;
+
+    while (active && stats_now() < deadline) {
+        reap_miners(&churn);
+        watch_net(&churn);
+        find_joined(&churn);
+        now = stats_now();
+
+        /* Replace a miner every 1/rate s, and top the population up at once */
+        if (churn.rate > 0 && now >= next_change) {
+            stop_miner(&churn);
+            next_change += 1e9/churn.rate;
+        }
+        while (churn.live < churn.population && spawn_miner(&churn) == EXIT_SUCCESS);
+
+        if (churn.net != NULL && now - churn.last_change > churn.hang_timeout*1e9) {
+            report_hang(&churn);
+            churn.hangs++;
+            break;
+        }
+
+        nanosleep(&tick, NULL);
+    }
+
+    /* Stop every miner the usual way, those left after hang_timeout are stuck */
+    for (i=0; i<churn.n_children; i++) {
+        if (churn.children[i].state != CHILD_DONE && churn.children[i].state != CHILD_KILLED) {
+            kill(churn.children[i].pid, SIGINT);
+            if (churn.children[i].state == CHILD_MINING) churn.interrupted++;
+            churn.children[i].state = CHILD_LEAVING;
+        }
+    }
+    stop_deadline = stats_now() + churn.hang_timeout*1e9;
+    while (churn.live > 0 && stats_now() < stop_deadline) {
+        reap_miners(&churn);
+        nanosleep(&tick, NULL);
+    }
+    if (churn.live > 0) {
+        fprintf(stderr, "Error: %d miners did not end, killing them\n", churn.live);
+        if (churn.hangs == 0) churn.hangs++;
+        for (i=0; i<churn.n_children; i++) {
+            if (churn.children[i].state != CHILD_DONE) kill(churn.children[i].pid, SIGKILL);
+        }
+        while (wait(NULL) > 0);
+    }
+
+    /* Whatever killed miners left behind */
+    if (churn.hangs > 0 || churn.killed > 0) {
+        while (wait(NULL) > 0);
+        shm_unlink(shard_shm(SHM_NAME_NET));
+        shm_unlink(shard_shm(SHM_NAME_BLOCK));
+        shm_unlink(shard_shm(SHM_NAME_REGISTRY));
+        shm_unlink(shard_shm(SHM_NAME_CHAIN));
+        shm_unlink(shard_shm(SHM_NAME_STATS));
+    }
+
+    print_results(&churn, (stats_now() - start)/1e9);
+
+    exit(churn.hangs > 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+}
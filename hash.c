@@ -0,0 +1,1095 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <immintrin.h>
+#include "hash.h"
+
+#define TRUE 1
+#define FALSE 0
+
+/* Kernels are written once with their parameters as arguments, and forced inline
+ * into per backend wrappers that pass constants, so every backend gets its own
+ * constant folded code */
+#define KERNEL static inline __attribute__((always_inline))
+#define KERNEL_AVX2 static inline __attribute__((always_inline, target("avx2")))
+#define KERNEL_AVX512 static inline __attribute__((always_inline, target("avx512f")))
+
+static const HashBackend *backend = NULL;
+static hash_kernel_fn kernel = NULL;
+static hash_multi_fn multi_kernel = NULL;
+static const char *kernel_name = "none";
+
+
+
+
+/**********************
+ ** Modular helpers **
+ **********************/
+
+/* Barrett reduction. With a constant p, floor(2^64/p) is folded too */
+KERNEL uint32_t reduce(uint64_t x, uint32_t p) {
+    uint64_t q, r;
+
+    /* q is floor(x/p) or one less, so a single correction is enough */
+    q = (uint64_t)(((unsigned __int128)x * (~(uint64_t)0 / p)) >> 64);
+    r = x - q*p;
+    if (r >= p) r -= p;
+
+    return (uint32_t) r;
+}
+
+KERNEL uint32_t add_mod(uint32_t x, uint32_t y, uint32_t p) {
+    x += y;
+    return (x >= p) ? x - p : x;
+}
+
+KERNEL uint32_t sub_mod(uint32_t x, uint32_t y, uint32_t p) {
+    return (x >= y) ? x - y : x + p - y;
+}
+
+/* x + y < 2p <= 2^32, and min(s, s-p) (unsigned) reduces it */
+KERNEL_AVX2 __m256i add_mod256(__m256i x, __m256i y, __m256i p) {
+    __m256i s = _mm256_add_epi32(x, y);
+    return _mm256_min_epu32(s, _mm256_sub_epi32(s, p));
+}
+
+KERNEL_AVX512 __m512i add_mod512(__m512i x, __m512i y, __m512i p) {
+    __m512i s = _mm512_add_epi32(x, y);
+    return _mm512_min_epu32(s, _mm512_sub_epi32(s, p));
+}
+
+
+
+
+/*******************
+ ** Affine family **
+ *******************/
+/*
+** hash(n) = (n*x + y) mod p. Consecutive candidates are hashed incrementally,
+** hash(n+k) = hash(n) + k*x (mod p), so the inner loops are an add, a conditional
+** subtract and a compare per candidate. Vector kernels keep one candidate per 32 bit
+** lane and compare every lane against the target at once.
+ */
+
+KERNEL uint32_t affine_value(uint64_t n, uint32_t p, uint32_t x, uint32_t y) {
+    return reduce((uint64_t)reduce(n, p)*x + y, p);
+}
+
+KERNEL long int affine_search_scalar(long int start, long int end, uint32_t target, volatile sig_atomic_t *run, uint32_t p, uint32_t x, uint32_t y) {
+    long int i, stop;
+    uint32_t h = affine_value(start, p, x, y);
+
+    for (i=start; i<end; ) {
+        stop = (end-i > HASH_CHECK_EVERY) ? i+HASH_CHECK_EVERY : end;
+        for (; i<stop; i++) {
+            if (h == target) return i;
+            h = add_mod(h, x, p);
+        }
+        if (!*run) return -1;
+    }
+
+    return -1;
+}
+
+#define AVX2_LANES 8
+#define AVX2_BLOCK (4*AVX2_LANES)
+
+KERNEL_AVX2 long int affine_search_avx2(long int start, long int end, uint32_t target, volatile sig_atomic_t *run, uint32_t p, uint32_t x, uint32_t y) {
+    __m256i h0, h1, h2, h3, m, vp, t, step;
+    uint32_t seed[AVX2_BLOCK];
+    long int i, checked;
+    int j;
+
+    if (end-start < AVX2_BLOCK) return affine_search_scalar(start, end, target, run, p, x, y);
+
+    for (j=0; j<AVX2_BLOCK; j++) seed[j] = affine_value(start+j, p, x, y);
+    h0 = _mm256_loadu_si256((__m256i*)(seed));
+    h1 = _mm256_loadu_si256((__m256i*)(seed+AVX2_LANES));
+    h2 = _mm256_loadu_si256((__m256i*)(seed+2*AVX2_LANES));
+    h3 = _mm256_loadu_si256((__m256i*)(seed+3*AVX2_LANES));
+    vp = _mm256_set1_epi32(p);
+    t = _mm256_set1_epi32(target);
+    step = _mm256_set1_epi32(reduce((uint64_t)AVX2_BLOCK*x, p));
+
+    for (i=start, checked=0; i+AVX2_BLOCK<=end; i+=AVX2_BLOCK, checked+=AVX2_BLOCK) {
+        m = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi32(h0, t), _mm256_cmpeq_epi32(h1, t)),
+                            _mm256_or_si256(_mm256_cmpeq_epi32(h2, t), _mm256_cmpeq_epi32(h3, t)));
+        if (!_mm256_testz_si256(m, m)) return affine_search_scalar(i, i+AVX2_BLOCK, target, run, p, x, y);
+
+        h0 = add_mod256(h0, step, vp);
+        h1 = add_mod256(h1, step, vp);
+        h2 = add_mod256(h2, step, vp);
+        h3 = add_mod256(h3, step, vp);
+
+        if (checked >= HASH_CHECK_EVERY) {
+            if (!*run) return -1;
+            checked = 0;
+        }
+    }
+
+    return affine_search_scalar(i, end, target, run, p, x, y);
+}
+
+#define AVX512_LANES 16
+#define AVX512_BLOCK (4*AVX512_LANES)
+
+KERNEL_AVX512 long int affine_search_avx512(long int start, long int end, uint32_t target, volatile sig_atomic_t *run, uint32_t p, uint32_t x, uint32_t y) {
+    __m512i h0, h1, h2, h3, vp, t, step;
+    uint32_t seed[AVX512_BLOCK];
+    long int i, checked;
+    int j;
+
+    if (end-start < AVX512_BLOCK) return affine_search_scalar(start, end, target, run, p, x, y);
+
+    for (j=0; j<AVX512_BLOCK; j++) seed[j] = affine_value(start+j, p, x, y);
+    h0 = _mm512_loadu_si512(seed);
+    h1 = _mm512_loadu_si512(seed+AVX512_LANES);
+    h2 = _mm512_loadu_si512(seed+2*AVX512_LANES);
+    h3 = _mm512_loadu_si512(seed+3*AVX512_LANES);
+    vp = _mm512_set1_epi32(p);
+    t = _mm512_set1_epi32(target);
+    step = _mm512_set1_epi32(reduce((uint64_t)AVX512_BLOCK*x, p));
+
+    for (i=start, checked=0; i+AVX512_BLOCK<=end; i+=AVX512_BLOCK, checked+=AVX512_BLOCK) {
+        if (_mm512_cmpeq_epi32_mask(h0, t) | _mm512_cmpeq_epi32_mask(h1, t)
+            | _mm512_cmpeq_epi32_mask(h2, t) | _mm512_cmpeq_epi32_mask(h3, t)) {
+            return affine_search_scalar(i, i+AVX512_BLOCK, target, run, p, x, y);
+        }
+
+        h0 = add_mod512(h0, step, vp);
+        h1 = add_mod512(h1, step, vp);
+        h2 = add_mod512(h2, step, vp);
+        h3 = add_mod512(h3, step, vp);
+
+        if (checked >= HASH_CHECK_EVERY) {
+            if (!*run) return -1;
+            checked = 0;
+        }
+    }
+
+    return affine_search_scalar(i, end, target, run, p, x, y);
+}
+
+KERNEL void affine_invert(uint32_t *table, long int start, long int end, uint32_t p, uint32_t x, uint32_t y) {
+    long int i;
+    uint32_t h = affine_value(start, p, x, y);
+
+    for (i=start; i<end; i++) {
+        table[h] = (uint32_t) i;
+        h = add_mod(h, x, p);
+    }
+}
+
+KERNEL void affine_range(uint64_t start, uint64_t *hashes, long int n, uint32_t p, uint32_t x, uint32_t y) {
+    long int i;
+    uint32_t h = affine_value(start, p, x, y);
+
+    for (i=0; i<n; i++) {
+        hashes[i] = h;
+        h = add_mod(h, x, p);
+    }
+}
+
+
+
+
+/******************
+ ** Cubic family **
+ ******************/
+/*
+** hash(n) = (n^3*x + y) mod p, a bijection when p = 2 (mod 3). A cubic is walked
+** with finite differences: stepping s candidates is h += d1, d1 += d2, d2 += d3,
+** with d3 = 6*x*s^3 constant, so the inner loops still need no multiplication.
+ */
+
+KERNEL uint32_t cubic_value(uint64_t n, uint32_t p, uint32_t x, uint32_t y) {
+    uint64_t r = reduce(n, p);
+    uint64_t r3 = reduce(reduce(r*r, p)*r, p);
+    return reduce(r3*x + y, p);
+}
+
+/* Differences of the cubic at n with step s */
+KERNEL void cubic_seed(long int n, long int s, uint32_t *h, uint32_t *d1, uint32_t *d2, uint32_t *d3, uint32_t p, uint32_t x, uint32_t y) {
+    uint32_t f0 = cubic_value(n, p, x, y), f1 = cubic_value(n+s, p, x, y);
+    uint32_t f2 = cubic_value(n+2*s, p, x, y), f3 = cubic_value(n+3*s, p, x, y);
+    uint32_t e0 = sub_mod(f1, f0, p), e1 = sub_mod(f2, f1, p), e2 = sub_mod(f3, f2, p);
+
+    *h = f0;
+    *d1 = e0;
+    *d2 = sub_mod(e1, e0, p);
+    *d3 = sub_mod(sub_mod(e2, e1, p), *d2, p);
+}
+
+KERNEL long int cubic_search_scalar(long int start, long int end, uint32_t target, volatile sig_atomic_t *run, uint32_t p, uint32_t x, uint32_t y) {
+    long int i, stop;
+    uint32_t h, d1, d2, d3;
+
+    cubic_seed(start, 1, &h, &d1, &d2, &d3, p, x, y);
+
+    for (i=start; i<end; ) {
+        stop = (end-i > HASH_CHECK_EVERY) ? i+HASH_CHECK_EVERY : end;
+        for (; i<stop; i++) {
+            if (h == target) return i;
+            h = add_mod(h, d1, p);
+            d1 = add_mod(d1, d2, p);
+            d2 = add_mod(d2, d3, p);
+        }
+        if (!*run) return -1;
+    }
+
+    return -1;
+}
+
+/* Two vectors per iteration, the six running differences use most registers */
+#define CUBIC_AVX2_BLOCK (2*AVX2_LANES)
+
+KERNEL_AVX2 long int cubic_search_avx2(long int start, long int end, uint32_t target, volatile sig_atomic_t *run, uint32_t p, uint32_t x, uint32_t y) {
+    __m256i h0, h1, e0, e1, g0, g1, m, vp, t, d3;
+    uint32_t sh[CUBIC_AVX2_BLOCK], se[CUBIC_AVX2_BLOCK], sg[CUBIC_AVX2_BLOCK], c;
+    long int i, checked;
+    int j;
+
+    if (end-start < CUBIC_AVX2_BLOCK) return cubic_search_scalar(start, end, target, run, p, x, y);
+
+    for (j=0; j<CUBIC_AVX2_BLOCK; j++) cubic_seed(start+j, CUBIC_AVX2_BLOCK, sh+j, se+j, sg+j, &c, p, x, y);
+    h0 = _mm256_loadu_si256((__m256i*)(sh));
+    h1 = _mm256_loadu_si256((__m256i*)(sh+AVX2_LANES));
+    e0 = _mm256_loadu_si256((__m256i*)(se));
+    e1 = _mm256_loadu_si256((__m256i*)(se+AVX2_LANES));
+    g0 = _mm256_loadu_si256((__m256i*)(sg));
+    g1 = _mm256_loadu_si256((__m256i*)(sg+AVX2_LANES));
+    vp = _mm256_set1_epi32(p);
+    t = _mm256_set1_epi32(target);
+    d3 = _mm256_set1_epi32(c); /* Same for every lane */
+
+    for (i=start, checked=0; i+CUBIC_AVX2_BLOCK<=end; i+=CUBIC_AVX2_BLOCK, checked+=CUBIC_AVX2_BLOCK) {
+        m = _mm256_or_si256(_mm256_cmpeq_epi32(h0, t), _mm256_cmpeq_epi32(h1, t));
+        if (!_mm256_testz_si256(m, m)) return cubic_search_scalar(i, i+CUBIC_AVX2_BLOCK, target, run, p, x, y);
+
+        h0 = add_mod256(h0, e0, vp);
+        h1 = add_mod256(h1, e1, vp);
+        e0 = add_mod256(e0, g0, vp);
+        e1 = add_mod256(e1, g1, vp);
+        g0 = add_mod256(g0, d3, vp);
+        g1 = add_mod256(g1, d3, vp);
+
+        if (checked >= HASH_CHECK_EVERY) {
+            if (!*run) return -1;
+            checked = 0;
+        }
+    }
+
+    return cubic_search_scalar(i, end, target, run, p, x, y);
+}
+
+#define CUBIC_AVX512_BLOCK (2*AVX512_LANES)
+
+KERNEL_AVX512 long int cubic_search_avx512(long int start, long int end, uint32_t target, volatile sig_atomic_t *run, uint32_t p, uint32_t x, uint32_t y) {
+    __m512i h0, h1, e0, e1, g0, g1, vp, t, d3;
+    uint32_t sh[CUBIC_AVX512_BLOCK], se[CUBIC_AVX512_BLOCK], sg[CUBIC_AVX512_BLOCK], c;
+    long int i, checked;
+    int j;
+
+    if (end-start < CUBIC_AVX512_BLOCK) return cubic_search_scalar(start, end, target, run, p, x, y);
+
+    for (j=0; j<CUBIC_AVX512_BLOCK; j++) cubic_seed(start+j, CUBIC_AVX512_BLOCK, sh+j, se+j, sg+j, &c, p, x, y);
+    h0 = _mm512_loadu_si512(sh);
+    h1 = _mm512_loadu_si512(sh+AVX512_LANES);
+    e0 = _mm512_loadu_si512(se);
+    e1 = _mm512_loadu_si512(se+AVX512_LANES);
+    g0 = _mm512_loadu_si512(sg);
+    g1 = _mm512_loadu_si512(sg+AVX512_LANES);
+    vp = _mm512_set1_epi32(p);
+    t = _mm512_set1_epi32(target);
+    d3 = _mm512_set1_epi32(c);
+
+    for (i=start, checked=0; i+CUBIC_AVX512_BLOCK<=end; i+=CUBIC_AVX512_BLOCK, checked+=CUBIC_AVX512_BLOCK) {
+        if (_mm512_cmpeq_epi32_mask(h0, t) | _mm512_cmpeq_epi32_mask(h1, t)) {
+            return cubic_search_scalar(i, i+CUBIC_AVX512_BLOCK, target, run, p, x, y);
+        }
+
+        h0 = add_mod512(h0, e0, vp);
+        h1 = add_mod512(h1, e1, vp);
+        e0 = add_mod512(e0, g0, vp);
+        e1 = add_mod512(e1, g1, vp);
+        g0 = add_mod512(g0, d3, vp);
+        g1 = add_mod512(g1, d3, vp);
+
+        if (checked >= HASH_CHECK_EVERY) {
+            if (!*run) return -1;
+            checked = 0;
+        }
+    }
+
+    return cubic_search_scalar(i, end, target, run, p, x, y);
+}
+
+KERNEL void cubic_invert(uint32_t *table, long int start, long int end, uint32_t p, uint32_t x, uint32_t y) {
+    long int i;
+    uint32_t h, d1, d2, d3;
+
+    cubic_seed(start, 1, &h, &d1, &d2, &d3, p, x, y);
+
+    for (i=start; i<end; i++) {
+        table[h] = (uint32_t) i;
+        h = add_mod(h, d1, p);
+        d1 = add_mod(d1, d2, p);
+        d2 = add_mod(d2, d3, p);
+    }
+}
+
+KERNEL void cubic_range(uint64_t start, uint64_t *hashes, long int n, uint32_t p, uint32_t x, uint32_t y) {
+    long int i;
+    uint32_t h, d1, d2, d3;
+
+    cubic_seed(start, 1, &h, &d1, &d2, &d3, p, x, y);
+
+    for (i=0; i<n; i++) {
+        hashes[i] = h;
+        h = add_mod(h, d1, p);
+        d1 = add_mod(d1, d2, p);
+        d2 = add_mod(d2, d3, p);
+    }
+}
+
+
+
+
+/*****************
+ ** Wide family **
+ *****************/
+/*
+** The affine hash with a modulus of up to 64 bits, chosen at run time. Products need
+** 128 bits, but only the seeds take one: with q = p - s precomputed, the inner loops
+** step h = (h >= q) ? h - q : h + s, which never overflows. Vector kernels keep one
+** candidate per 64 bit lane; moduli below 2^31 reuse the 32 bit affine kernels.
+ */
+
+KERNEL uint64_t mul_mod64(uint64_t a, uint64_t b, uint64_t p) {
+    return (uint64_t)(((unsigned __int128)a * b) % p);
+}
+
+/* h + s (mod p), with q = p - s */
+KERNEL uint64_t add_mod64(uint64_t h, uint64_t s, uint64_t q) {
+    return (h >= q) ? h - q : h + s;
+}
+
+/* AVX2 has no unsigned 64 bit compare, so both sides are biased by 2^63 */
+KERNEL_AVX2 __m256i add_mod64_256(__m256i h, __m256i s, __m256i q, __m256i q_biased) {
+    __m256i lt = _mm256_cmpgt_epi64(q_biased, _mm256_xor_si256(h, _mm256_set1_epi64x(INT64_MIN)));
+    return _mm256_blendv_epi8(_mm256_sub_epi64(h, q), _mm256_add_epi64(h, s), lt);
+}
+
+KERNEL_AVX512 __m512i add_mod64_512(__m512i h, __m512i s, __m512i q) {
+    return _mm512_mask_sub_epi64(_mm512_add_epi64(h, s), _mm512_cmpge_epu64_mask(h, q), h, q);
+}
+
+KERNEL uint64_t wide_value(uint64_t n, uint64_t p, uint64_t x, uint64_t y) {
+    return add_mod64(mul_mod64(n % p, x, p), y, p - y);
+}
+
+KERNEL uint64_t wide_search_scalar(uint64_t start, uint64_t end, uint64_t target, volatile sig_atomic_t *run, uint64_t p, uint64_t x, uint64_t y) {
+    uint64_t i, stop, q = p - x;
+    uint64_t h = wide_value(start, p, x, y);
+
+    for (i=start; i<end; ) {
+        stop = (end-i > HASH_CHECK_EVERY) ? i+HASH_CHECK_EVERY : end;
+        for (; i<stop; i++) {
+            if (h == target) return i;
+            h = add_mod64(h, x, q);
+        }
+        if (!*run) return HASH_NONE;
+    }
+
+    return HASH_NONE;
+}
+
+#define WIDE_AVX2_LANES 4
+#define WIDE_AVX2_BLOCK (4*WIDE_AVX2_LANES)
+
+KERNEL_AVX2 uint64_t wide_search_avx2(uint64_t start, uint64_t end, uint64_t target, volatile sig_atomic_t *run, uint64_t p, uint64_t x, uint64_t y) {
+    __m256i h0, h1, h2, h3, m, t, step, q, qb;
+    uint64_t seed[WIDE_AVX2_BLOCK], s, i, checked;
+    int j;
+
+    if (end-start < WIDE_AVX2_BLOCK) return wide_search_scalar(start, end, target, run, p, x, y);
+
+    for (j=0; j<WIDE_AVX2_BLOCK; j++) seed[j] = wide_value(start+j, p, x, y);
+    h0 = _mm256_loadu_si256((__m256i*)(seed));
+    h1 = _mm256_loadu_si256((__m256i*)(seed+WIDE_AVX2_LANES));
+    h2 = _mm256_loadu_si256((__m256i*)(seed+2*WIDE_AVX2_LANES));
+    h3 = _mm256_loadu_si256((__m256i*)(seed+3*WIDE_AVX2_LANES));
+    s = mul_mod64(WIDE_AVX2_BLOCK, x, p);
+    t = _mm256_set1_epi64x(target);
+    step = _mm256_set1_epi64x(s);
+    q = _mm256_set1_epi64x(p - s);
+    qb = _mm256_set1_epi64x((p - s) ^ (1ULL << 63));
+
+    for (i=start, checked=0; end-i >= WIDE_AVX2_BLOCK; i+=WIDE_AVX2_BLOCK, checked+=WIDE_AVX2_BLOCK) {
+        m = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi64(h0, t), _mm256_cmpeq_epi64(h1, t)),
+                            _mm256_or_si256(_mm256_cmpeq_epi64(h2, t), _mm256_cmpeq_epi64(h3, t)));
+        if (!_mm256_testz_si256(m, m)) return wide_search_scalar(i, i+WIDE_AVX2_BLOCK, target, run, p, x, y);
+
+        h0 = add_mod64_256(h0, step, q, qb);
+        h1 = add_mod64_256(h1, step, q, qb);
+        h2 = add_mod64_256(h2, step, q, qb);
+        h3 = add_mod64_256(h3, step, q, qb);
+
+        if (checked >= HASH_CHECK_EVERY) {
+            if (!*run) return HASH_NONE;
+            checked = 0;
+        }
+    }
+
+    return wide_search_scalar(i, end, target, run, p, x, y);
+}
+
+#define WIDE_AVX512_LANES 8
+#define WIDE_AVX512_BLOCK (4*WIDE_AVX512_LANES)
+
+KERNEL_AVX512 uint64_t wide_search_avx512(uint64_t start, uint64_t end, uint64_t target, volatile sig_atomic_t *run, uint64_t p, uint64_t x, uint64_t y) {
+    __m512i h0, h1, h2, h3, t, step, q;
+    uint64_t seed[WIDE_AVX512_BLOCK], s, i, checked;
+    int j;
+
+    if (end-start < WIDE_AVX512_BLOCK) return wide_search_scalar(start, end, target, run, p, x, y);
+
+    for (j=0; j<WIDE_AVX512_BLOCK; j++) seed[j] = wide_value(start+j, p, x, y);
+    h0 = _mm512_loadu_si512(seed);
+    h1 = _mm512_loadu_si512(seed+WIDE_AVX512_LANES);
+    h2 = _mm512_loadu_si512(seed+2*WIDE_AVX512_LANES);
+    h3 = _mm512_loadu_si512(seed+3*WIDE_AVX512_LANES);
+    s = mul_mod64(WIDE_AVX512_BLOCK, x, p);
+    t = _mm512_set1_epi64(target);
+    step = _mm512_set1_epi64(s);
+    q = _mm512_set1_epi64(p - s);
+
+    for (i=start, checked=0; end-i >= WIDE_AVX512_BLOCK; i+=WIDE_AVX512_BLOCK, checked+=WIDE_AVX512_BLOCK) {
+        if (_mm512_cmpeq_epi64_mask(h0, t) | _mm512_cmpeq_epi64_mask(h1, t)
+            | _mm512_cmpeq_epi64_mask(h2, t) | _mm512_cmpeq_epi64_mask(h3, t)) {
+            return wide_search_scalar(i, i+WIDE_AVX512_BLOCK, target, run, p, x, y);
+        }
+
+        h0 = add_mod64_512(h0, step, q);
+        h1 = add_mod64_512(h1, step, q);
+        h2 = add_mod64_512(h2, step, q);
+        h3 = add_mod64_512(h3, step, q);
+
+        if (checked >= HASH_CHECK_EVERY) {
+            if (!*run) return HASH_NONE;
+            checked = 0;
+        }
+    }
+
+    return wide_search_scalar(i, end, target, run, p, x, y);
+}
+
+KERNEL void wide_invert(uint32_t *table, long int start, long int end, uint64_t p, uint64_t x, uint64_t y) {
+    long int i;
+    uint64_t h = wide_value(start, p, x, y), q = p - x;
+
+    for (i=start; i<end; i++) {
+        table[h] = (uint32_t) i;
+        h = add_mod64(h, x, q);
+    }
+}
+
+KERNEL void wide_range(uint64_t start, uint64_t *hashes, long int n, uint64_t p, uint64_t x, uint64_t y) {
+    long int i;
+    uint64_t h = wide_value(start, p, x, y), q = p - x;
+
+    for (i=0; i<n; i++) {
+        hashes[i] = h;
+        h = add_mod64(h, x, q);
+    }
+}
+
+/* Private */
+uint64_t pow_mod64(uint64_t b, uint64_t e, uint64_t p) {
+    uint64_t r = 1;
+
+    for (b %= p; e > 0; e >>= 1) {
+        if (e & 1) r = mul_mod64(r, b, p);
+        b = mul_mod64(b, b, p);
+    }
+
+    return r;
+}
+
+/* Private. Miller-Rabin, deterministic below 2^64 with the first 12 primes as bases */
+int is_prime64(uint64_t n) {
+    static const uint64_t bases[] = {2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37};
+    uint64_t d, a;
+    int i, r, s;
+
+    if (n < 2) return FALSE;
+    for (i=0; i<12; i++) {
+        if (n == bases[i]) return TRUE;
+        if (n % bases[i] == 0) return FALSE;
+    }
+
+    for (d=n-1, s=0; (d & 1) == 0; d >>= 1, s++);
+
+    for (i=0; i<12; i++) {
+        a = pow_mod64(bases[i], d, n);
+        if (a == 1 || a == n-1) continue;
+        for (r=1; r<s && a != n-1; r++) a = mul_mod64(a, a, n);
+        if (a != n-1) return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+
+
+/*************************
+ ** Multi-target search **
+ *************************/
+/*
+** Every candidate is hashed once and checked against all the targets. The affine
+** vector kernels compare few targets lane by lane, one compare per target; past
+** HASH_SIMD_TARGETS they gather each lane's bit from a bitmap of the targets' low
+** bits, which fits in L1. The other kernels write hashes out a block at a time and
+** test the same bitmap. Only hashes passing it are searched among the sorted targets.
+ */
+
+#define MULTI_BLOCK 1024
+#define FILTER_MASK ((1UL << HASH_FILTER_BITS) - 1)
+
+typedef void (*range_fn)(uint64_t start, uint64_t *hashes, long int n);
+
+/* Private. Sets candidate as the solution of every target equal to h not solved yet,
+ * returns how many were. Workers sharing solutions each claim a target at most once */
+long int targets_record(const HashTargets *targets, uint64_t h, uint64_t candidate, uint64_t *solutions) {
+    int lo = 0, hi = targets->n, mid;
+    long int found = 0;
+    uint64_t none;
+
+    /* First target not below h */
+    while (lo < hi) {
+        mid = (lo + hi)/2;
+        if (targets->sorted[mid] < h) lo = mid + 1;
+        else hi = mid;
+    }
+
+    for (; lo < targets->n && targets->sorted[lo] == h; lo++) {
+        none = HASH_NONE;
+        if (__atomic_compare_exchange_n(solutions + targets->index[lo], &none, candidate, FALSE, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) found++;
+    }
+
+    return found;
+}
+
+KERNEL int filter_test(const HashTargets *targets, uint64_t h) {
+    return (targets->filter[(h & FILTER_MASK) >> 6] >> (h & 63)) & 1;
+}
+
+KERNEL long int multi_filter(uint64_t start, uint64_t end, const HashTargets *targets, uint64_t *solutions, volatile sig_atomic_t *run, range_fn range) {
+    uint64_t hashes[MULTI_BLOCK], i, checked;
+    long int j, n, found = 0;
+
+    for (i=start, checked=0; i<end; i+=n, checked+=n) {
+        n = (end-i > MULTI_BLOCK) ? MULTI_BLOCK : end-i;
+        range(i, hashes, n);
+        for (j=0; j<n; j++) {
+            if (filter_test(targets, hashes[j])) found += targets_record(targets, hashes[j], i+j, solutions);
+        }
+
+        if (checked >= HASH_CHECK_EVERY) {
+            if (!*run) return found;
+            checked = 0;
+        }
+    }
+
+    return found;
+}
+
+/* Private. Records the lanes set in mask, candidate base + j hashing to hashes[j] */
+long int record_lanes(const HashTargets *targets, const uint32_t *hashes, uint64_t mask, uint64_t base, uint64_t *solutions) {
+    long int found = 0;
+    int j;
+
+    for (; mask != 0; mask &= mask - 1) {
+        j = __builtin_ctzll(mask);
+        found += targets_record(targets, hashes[j], base + j, solutions);
+    }
+
+    return found;
+}
+
+/* Whether a lane of the block equals one of the n targets t. Hits are rare, which
+ * lanes is left to record_lanes */
+KERNEL_AVX2 int compare_avx2(__m256i h0, __m256i h1, __m256i h2, __m256i h3, const __m256i *t, int n) {
+    __m256i m = _mm256_setzero_si256();
+    int k;
+
+    for (k=0; k<n; k++) {
+        m = _mm256_or_si256(m, _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi32(h0, t[k]), _mm256_cmpeq_epi32(h1, t[k])),
+                                               _mm256_or_si256(_mm256_cmpeq_epi32(h2, t[k]), _mm256_cmpeq_epi32(h3, t[k]))));
+    }
+    return !_mm256_testz_si256(m, m);
+}
+
+/* Lanes of h whose bit is set in the filter */
+KERNEL_AVX2 uint32_t filter_avx2(__m256i h, const int *filter) {
+    __m256i low = _mm256_and_si256(h, _mm256_set1_epi32(FILTER_MASK));
+    __m256i w = _mm256_i32gather_epi32(filter, _mm256_srli_epi32(low, 5), 4);
+    __m256i bit = _mm256_sllv_epi32(_mm256_set1_epi32(1), _mm256_and_si256(h, _mm256_set1_epi32(31)));
+
+    return ~_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(w, bit), _mm256_setzero_si256()))) & 0xff;
+}
+
+KERNEL_AVX2 long int affine_search_multi_avx2(uint64_t start, uint64_t end, const HashTargets *targets, uint64_t *solutions, volatile sig_atomic_t *run, range_fn range, uint32_t p, uint32_t x, uint32_t y) {
+    __m256i h0, h1, h2, h3, vp, step, t[HASH_SIMD_TARGETS];
+    uint32_t seed[AVX2_BLOCK];
+    uint64_t i, checked, m;
+    long int found = 0;
+    int j, compare = (targets->n <= HASH_SIMD_TARGETS);
+
+    if (end-start < AVX2_BLOCK) return multi_filter(start, end, targets, solutions, run, range);
+
+    for (j=0; j<AVX2_BLOCK; j++) seed[j] = affine_value(start+j, p, x, y);
+    h0 = _mm256_loadu_si256((__m256i*)(seed));
+    h1 = _mm256_loadu_si256((__m256i*)(seed+AVX2_LANES));
+    h2 = _mm256_loadu_si256((__m256i*)(seed+2*AVX2_LANES));
+    h3 = _mm256_loadu_si256((__m256i*)(seed+3*AVX2_LANES));
+    vp = _mm256_set1_epi32(p);
+    step = _mm256_set1_epi32(reduce((uint64_t)AVX2_BLOCK*x, p));
+    for (j=0; compare && j<targets->n; j++) t[j] = _mm256_set1_epi32(targets->sorted[j]);
+
+    for (i=start, checked=0; i+AVX2_BLOCK<=end; i+=AVX2_BLOCK, checked+=AVX2_BLOCK) {
+        if (compare) m = compare_avx2(h0, h1, h2, h3, t, targets->n) ? UINT32_MAX : 0;
+        else {
+            m = filter_avx2(h0, (const int*) targets->filter) | filter_avx2(h1, (const int*) targets->filter) << AVX2_LANES
+                | filter_avx2(h2, (const int*) targets->filter) << 2*AVX2_LANES | filter_avx2(h3, (const int*) targets->filter) << 3*AVX2_LANES;
+        }
+        if (m != 0) {
+            _mm256_storeu_si256((__m256i*)(seed), h0);
+            _mm256_storeu_si256((__m256i*)(seed+AVX2_LANES), h1);
+            _mm256_storeu_si256((__m256i*)(seed+2*AVX2_LANES), h2);
+            _mm256_storeu_si256((__m256i*)(seed+3*AVX2_LANES), h3);
+            found += record_lanes(targets, seed, m, i, solutions);
+        }
+
+        h0 = add_mod256(h0, step, vp);
+        h1 = add_mod256(h1, step, vp);
+        h2 = add_mod256(h2, step, vp);
+        h3 = add_mod256(h3, step, vp);
+
+        if (checked >= HASH_CHECK_EVERY) {
+            if (!*run) return found;
+            checked = 0;
+        }
+    }
+
+    return found + multi_filter(i, end, targets, solutions, run, range);
+}
+
+KERNEL_AVX512 int compare_avx512(__m512i h0, __m512i h1, __m512i h2, __m512i h3, const __m512i *t, int n) {
+    __mmask16 m = 0;
+    int k;
+
+    for (k=0; k<n; k++) {
+        m |= _mm512_cmpeq_epi32_mask(h0, t[k]) | _mm512_cmpeq_epi32_mask(h1, t[k])
+            | _mm512_cmpeq_epi32_mask(h2, t[k]) | _mm512_cmpeq_epi32_mask(h3, t[k]);
+    }
+    return m != 0;
+}
+
+KERNEL_AVX512 __mmask16 filter_avx512(__m512i h, const int *filter) {
+    __m512i low = _mm512_and_si512(h, _mm512_set1_epi32(FILTER_MASK));
+    __m512i w = _mm512_i32gather_epi32(_mm512_srli_epi32(low, 5), filter, 4);
+    __m512i bit = _mm512_sllv_epi32(_mm512_set1_epi32(1), _mm512_and_si512(h, _mm512_set1_epi32(31)));
+
+    return _mm512_test_epi32_mask(w, bit);
+}
+
+KERNEL_AVX512 long int affine_search_multi_avx512(uint64_t start, uint64_t end, const HashTargets *targets, uint64_t *solutions, volatile sig_atomic_t *run, range_fn range, uint32_t p, uint32_t x, uint32_t y) {
+    __m512i h0, h1, h2, h3, vp, step, t[HASH_SIMD_TARGETS];
+    uint32_t seed[AVX512_BLOCK];
+    uint64_t i, checked, m;
+    long int found = 0;
+    int j, compare = (targets->n <= HASH_SIMD_TARGETS);
+
+    if (end-start < AVX512_BLOCK) return multi_filter(start, end, targets, solutions, run, range);
+
+    for (j=0; j<AVX512_BLOCK; j++) seed[j] = affine_value(start+j, p, x, y);
+    h0 = _mm512_loadu_si512(seed);
+    h1 = _mm512_loadu_si512(seed+AVX512_LANES);
+    h2 = _mm512_loadu_si512(seed+2*AVX512_LANES);
+    h3 = _mm512_loadu_si512(seed+3*AVX512_LANES);
+    vp = _mm512_set1_epi32(p);
+    step = _mm512_set1_epi32(reduce((uint64_t)AVX512_BLOCK*x, p));
+    for (j=0; compare && j<targets->n; j++) t[j] = _mm512_set1_epi32(targets->sorted[j]);
+
+    for (i=start, checked=0; i+AVX512_BLOCK<=end; i+=AVX512_BLOCK, checked+=AVX512_BLOCK) {
+        if (compare) m = compare_avx512(h0, h1, h2, h3, t, targets->n) ? UINT64_MAX : 0;
+        else {
+            m = (uint64_t) filter_avx512(h0, (const int*) targets->filter) | (uint64_t) filter_avx512(h1, (const int*) targets->filter) << AVX512_LANES
+                | (uint64_t) filter_avx512(h2, (const int*) targets->filter) << 2*AVX512_LANES | (uint64_t) filter_avx512(h3, (const int*) targets->filter) << 3*AVX512_LANES;
+        }
+        if (m != 0) {
+            _mm512_storeu_si512(seed, h0);
+            _mm512_storeu_si512(seed+AVX512_LANES, h1);
+            _mm512_storeu_si512(seed+2*AVX512_LANES, h2);
+            _mm512_storeu_si512(seed+3*AVX512_LANES, h3);
+            found += record_lanes(targets, seed, m, i, solutions);
+        }
+
+        h0 = add_mod512(h0, step, vp);
+        h1 = add_mod512(h1, step, vp);
+        h2 = add_mod512(h2, step, vp);
+        h3 = add_mod512(h3, step, vp);
+
+        if (checked >= HASH_CHECK_EVERY) {
+            if (!*run) return found;
+            checked = 0;
+        }
+    }
+
+    return found + multi_filter(i, end, targets, solutions, run, range);
+}
+
+/* The cubic's running differences leave no registers for the targets, its vector
+ * kernels are the filter over the backend's range, which needs no parameters */
+#define cubic_search_multi_avx2(start, end, targets, solutions, run, range, p, x, y) multi_filter(start, end, targets, solutions, run, range)
+#define cubic_search_multi_avx512(start, end, targets, solutions, run, range, p, x, y) multi_filter(start, end, targets, solutions, run, range)
+
+
+
+
+/**************
+ ** Backends **
+ **************/
+
+/* Instantiates the specialized functions of a backend, named be_<id>_<function> */
+#define DEFINE_BACKEND(id, fam, P, X, Y) \
+    static uint64_t be_##id##_hash(uint64_t n) { \
+        return fam##_value(n, P, (X) % (P), (Y) % (P)); \
+    } \
+    static uint64_t be_##id##_search_scalar(uint64_t start, uint64_t end, uint64_t target, volatile sig_atomic_t *run) { \
+        long int r = fam##_search_scalar(start, end, target, run, P, (X) % (P), (Y) % (P)); \
+        return (r < 0) ? HASH_NONE : (uint64_t) r; \
+    } \
+    __attribute__((target("avx2"))) \
+    static uint64_t be_##id##_search_avx2(uint64_t start, uint64_t end, uint64_t target, volatile sig_atomic_t *run) { \
+        long int r = fam##_search_avx2(start, end, target, run, P, (X) % (P), (Y) % (P)); \
+        return (r < 0) ? HASH_NONE : (uint64_t) r; \
+    } \
+    __attribute__((target("avx512f"))) \
+    static uint64_t be_##id##_search_avx512(uint64_t start, uint64_t end, uint64_t target, volatile sig_atomic_t *run) { \
+        long int r = fam##_search_avx512(start, end, target, run, P, (X) % (P), (Y) % (P)); \
+        return (r < 0) ? HASH_NONE : (uint64_t) r; \
+    } \
+    static void be_##id##_invert_range(uint32_t *table, long int start, long int end) { \
+        fam##_invert(table, start, end, P, (X) % (P), (Y) % (P)); \
+    } \
+    static void be_##id##_hash_batch(const uint64_t *numbers, uint64_t *hashes, long int n) { \
+        for (long int i=0; i<n; i++) hashes[i] = fam##_value(numbers[i], P, (X) % (P), (Y) % (P)); \
+    } \
+    static void be_##id##_hash_range(uint64_t start, uint64_t *hashes, long int n) { \
+        fam##_range(start, hashes, n, P, (X) % (P), (Y) % (P)); \
+    } \
+    static long int be_##id##_search_multi_scalar(uint64_t start, uint64_t end, const HashTargets *targets, uint64_t *solutions, volatile sig_atomic_t *run) { \
+        return multi_filter(start, end, targets, solutions, run, be_##id##_hash_range); \
+    } \
+    __attribute__((target("avx2"))) \
+    static long int be_##id##_search_multi_avx2(uint64_t start, uint64_t end, const HashTargets *targets, uint64_t *solutions, volatile sig_atomic_t *run) { \
+        return fam##_search_multi_avx2(start, end, targets, solutions, run, be_##id##_hash_range, P, (X) % (P), (Y) % (P)); \
+    } \
+    __attribute__((target("avx512f"))) \
+    static long int be_##id##_search_multi_avx512(uint64_t start, uint64_t end, const HashTargets *targets, uint64_t *solutions, volatile sig_atomic_t *run) { \
+        return fam##_search_multi_avx512(start, end, targets, solutions, run, be_##id##_hash_range, P, (X) % (P), (Y) % (P)); \
+    }
+
+#define BACKEND(id, fam, P, X, Y) \
+    { #id, #fam, P, X, Y, be_##id##_hash, be_##id##_search_scalar, be_##id##_search_avx2, be_##id##_search_avx512, be_##id##_invert_range, be_##id##_hash_batch, \
+      be_##id##_search_multi_scalar, be_##id##_search_multi_avx2, be_##id##_search_multi_avx512 }
+
+DEFINE_BACKEND(default, affine, PRIME, BIG_X, BIG_Y)
+DEFINE_BACKEND(easy, affine, 999983, BIG_X, BIG_Y)
+DEFINE_BACKEND(hard, affine, 2147483647, BIG_X, BIG_Y)
+DEFINE_BACKEND(cubic, cubic, 99997649, BIG_X, BIG_Y)
+
+static const HashBackend backends[] = {
+    BACKEND(default, affine, PRIME, BIG_X, BIG_Y),
+    BACKEND(easy, affine, 999983, BIG_X, BIG_Y),
+    BACKEND(hard, affine, 2147483647, BIG_X, BIG_Y),
+    BACKEND(cubic, cubic, 99997649, BIG_X, BIG_Y)
+};
+
+#define N_BACKENDS (int)(sizeof(backends)/sizeof(backends[0]))
+
+/* The wide backend has its parameters set by hash_setup, so they are not constants */
+static uint64_t wide_p, wide_x, wide_y;
+static char wide_name[HASH_NAME_LEN];
+
+static uint64_t be_wide_hash(uint64_t n) {
+    return wide_value(n, wide_p, wide_x, wide_y);
+}
+
+static uint64_t be_wide_search_scalar(uint64_t start, uint64_t end, uint64_t target, volatile sig_atomic_t *run) {
+    long int r;
+
+    if (wide_p < (1UL << 31)) {
+        r = affine_search_scalar(start, end, target, run, wide_p, wide_x, wide_y);
+        return (r < 0) ? HASH_NONE : (uint64_t) r;
+    }
+    return wide_search_scalar(start, end, target, run, wide_p, wide_x, wide_y);
+}
+
+__attribute__((target("avx2")))
+static uint64_t be_wide_search_avx2(uint64_t start, uint64_t end, uint64_t target, volatile sig_atomic_t *run) {
+    long int r;
+
+    if (wide_p < (1UL << 31)) {
+        r = affine_search_avx2(start, end, target, run, wide_p, wide_x, wide_y);
+        return (r < 0) ? HASH_NONE : (uint64_t) r;
+    }
+    return wide_search_avx2(start, end, target, run, wide_p, wide_x, wide_y);
+}
+
+__attribute__((target("avx512f")))
+static uint64_t be_wide_search_avx512(uint64_t start, uint64_t end, uint64_t target, volatile sig_atomic_t *run) {
+    long int r;
+
+    if (wide_p < (1UL << 31)) {
+        r = affine_search_avx512(start, end, target, run, wide_p, wide_x, wide_y);
+        return (r < 0) ? HASH_NONE : (uint64_t) r;
+    }
+    return wide_search_avx512(start, end, target, run, wide_p, wide_x, wide_y);
+}
+
+static void be_wide_invert_range(uint32_t *table, long int start, long int end) {
+    wide_invert(table, start, end, wide_p, wide_x, wide_y);
+}
+
+static void be_wide_hash_batch(const uint64_t *numbers, uint64_t *hashes, long int n) {
+    for (long int i=0; i<n; i++) hashes[i] = wide_value(numbers[i], wide_p, wide_x, wide_y);
+}
+
+static void be_wide_hash_range(uint64_t start, uint64_t *hashes, long int n) {
+    wide_range(start, hashes, n, wide_p, wide_x, wide_y);
+}
+
+static long int be_wide_search_multi_scalar(uint64_t start, uint64_t end, const HashTargets *targets, uint64_t *solutions, volatile sig_atomic_t *run) {
+    return multi_filter(start, end, targets, solutions, run, be_wide_hash_range);
+}
+
+/* 64 bit lanes would compare half as many candidates per target, only moduli below
+ * 2^31 get the vector compare */
+__attribute__((target("avx2")))
+static long int be_wide_search_multi_avx2(uint64_t start, uint64_t end, const HashTargets *targets, uint64_t *solutions, volatile sig_atomic_t *run) {
+    if (wide_p < (1UL << 31)) return affine_search_multi_avx2(start, end, targets, solutions, run, be_wide_hash_range, wide_p, wide_x, wide_y);
+    return multi_filter(start, end, targets, solutions, run, be_wide_hash_range);
+}
+
+__attribute__((target("avx512f")))
+static long int be_wide_search_multi_avx512(uint64_t start, uint64_t end, const HashTargets *targets, uint64_t *solutions, volatile sig_atomic_t *run) {
+    if (wide_p < (1UL << 31)) return affine_search_multi_avx512(start, end, targets, solutions, run, be_wide_hash_range, wide_p, wide_x, wide_y);
+    return multi_filter(start, end, targets, solutions, run, be_wide_hash_range);
+}
+
+static HashBackend wide_backend = {
+    wide_name, "affine", 0, 0, 0, be_wide_hash, be_wide_search_scalar, be_wide_search_avx2, be_wide_search_avx512, be_wide_invert_range, be_wide_hash_batch,
+    be_wide_search_multi_scalar, be_wide_search_multi_avx2, be_wide_search_multi_avx512
+};
+
+/* Private. Sets up the wide backend from a name "wide<bits>" */
+int wide_setup(const char *name) {
+    char extra;
+    int bits;
+
+    if (sscanf(name, "wide%d%c", &bits, &extra) != 1 || bits < WIDE_MIN_BITS || bits > WIDE_MAX_BITS) return EXIT_FAILURE;
+
+    /* Largest prime below 2^bits. Never 2^64 - 1, which is HASH_NONE */
+    wide_p = (bits == 64) ? UINT64_MAX : (1ULL << bits) - 1;
+    while (!is_prime64(wide_p)) wide_p -= 2;
+
+    /* A multiple of p as multiplier would not be a bijection */
+    wide_x = WIDE_X % wide_p;
+    if (wide_x == 0) wide_x = 1;
+    wide_y = WIDE_Y % wide_p;
+
+    snprintf(wide_name, sizeof(wide_name), "wide%d", bits);
+    wide_backend.modulus = wide_p;
+    wide_backend.multiplier = wide_x;
+    wide_backend.addend = wide_y;
+
+    return EXIT_SUCCESS;
+}
+
+
+
+
+/*********************
+ ** Backend dispatch **
+ *********************/
+
+int hash_setup(const char *backend_name) {
+    char *forced = getenv("HASH_KERNEL"); /* Allows benchmarking every kernel on the same host */
+    int i;
+
+    if (backend_name == NULL) backend_name = backends[0].name;
+
+    for (i=0; i<N_BACKENDS && strcmp(backends[i].name, backend_name) != 0; i++);
+    if (i < N_BACKENDS) backend = backends+i;
+    else if (wide_setup(backend_name) == EXIT_SUCCESS) backend = &wide_backend;
+    else {
+        fprintf(stderr, "Error: unknown hash backend %s\n", backend_name);
+        return EXIT_FAILURE;
+    }
+
+    __builtin_cpu_init();
+
+    if (forced != NULL && strcmp(forced, "scalar") == 0) {
+        kernel = backend->search_scalar;
+        multi_kernel = backend->search_multi_scalar;
+        kernel_name = "scalar";
+    }
+    else if (__builtin_cpu_supports("avx512f") && (forced == NULL || strcmp(forced, "avx512") == 0)) {
+        kernel = backend->search_avx512;
+        multi_kernel = backend->search_multi_avx512;
+        kernel_name = "avx512";
+    }
+    else if (__builtin_cpu_supports("avx2") && (forced == NULL || strcmp(forced, "avx2") == 0 || strcmp(forced, "avx512") == 0)) {
+        kernel = backend->search_avx2;
+        multi_kernel = backend->search_multi_avx2;
+        kernel_name = "avx2";
+    }
+    else {
+        kernel = backend->search_scalar;
+        multi_kernel = backend->search_multi_scalar;
+        kernel_name = "scalar";
+    }
+
+    return EXIT_SUCCESS;
+}
+
+void hash_list_backends(FILE *stream) {
+    int i;
+
+    for (i=0; i<N_BACKENDS; i++) {
+        fprintf(stream, "  %-8s %s, modulus %" PRIu64 "\n", backends[i].name, backends[i].family, backends[i].modulus);
+    }
+    fprintf(stream, "  %-8s affine, modulus the largest prime below 2^N (%d <= N <= %d)\n", "wide<N>", WIDE_MIN_BITS, WIDE_MAX_BITS);
+}
+
+const HashBackend *hash_backend() {
+    if (backend == NULL) hash_setup(NULL);
+    return backend;
+}
+
+const char *hash_kernel_name() {
+    return kernel_name;
+}
+
+uint64_t hash_keyspace() {
+    return hash_backend()->modulus;
+}
+
+uint64_t simple_hash(uint64_t number) {
+    return hash_backend()->hash(number);
+}
+
+int hash_verify(uint64_t solution, uint64_t target) {
+    const HashBackend *b = hash_backend();
+
+    if (solution >= b->modulus) return FALSE;
+    return b->hash(solution) == target;
+}
+
+uint64_t hash_search(uint64_t start, uint64_t end, uint64_t target, volatile sig_atomic_t *run) {
+    const HashBackend *b = hash_backend();
+
+    /* Every hash is in [0, modulus), other targets have no preimage */
+    if (target >= b->modulus) return HASH_NONE;
+    if (end > b->modulus) end = b->modulus;
+    if (start >= end) return HASH_NONE;
+
+    return kernel(start, end, target, run);
+}
+
+/* hashes[i] = hash(numbers[i]), numbers must be below the modulus. Independent
+ * hashes, unlike the chained ones of a search */
+void hash_batch(const uint64_t *numbers, uint64_t *hashes, long int n) {
+    hash_backend()->hash_batch(numbers, hashes, n);
+}
+
+/* Writes table[hash(i)] = i for every i in [start, end) */
+void hash_invert_range(uint32_t *table, long int start, long int end) {
+    hash_backend()->invert_range(table, start, end);
+}
+
+/* Private */
+int compare_targets(const void *a, const void *b) {
+    uint64_t x = ((const uint64_t*)a)[0], y = ((const uint64_t*)b)[0];
+
+    return (x > y) - (x < y);
+}
+
+/* Prepares n targets for hash_search_multi. Targets at or past the modulus have no
+ * preimage and are left out */
+int hash_targets_init(HashTargets *targets, const uint64_t *list, int n) {
+    uint64_t (*pairs)[2], modulus = hash_keyspace();
+    int i;
+
+    targets->n = 0;
+    targets->sorted = (uint64_t*) malloc(n*sizeof(uint64_t) + 1);
+    targets->index = (int*) malloc(n*sizeof(int) + 1);
+    pairs = malloc(n*sizeof(*pairs) + 1);
+    if (targets->sorted == NULL || targets->index == NULL || pairs == NULL) {
+        perror("Error: could not alloc memory\nmalloc");
+        free(pairs);
+        hash_targets_free(targets);
+        return EXIT_FAILURE;
+    }
+
+    for (i=0; i<n; i++) {
+        if (list[i] >= modulus) continue;
+        pairs[targets->n][0] = list[i];
+        pairs[targets->n][1] = i;
+        targets->n++;
+    }
+    qsort(pairs, targets->n, sizeof(*pairs), compare_targets);
+
+    memset(targets->filter, 0, sizeof(targets->filter));
+    for (i=0; i<targets->n; i++) {
+        targets->sorted[i] = pairs[i][0];
+        targets->index[i] = (int) pairs[i][1];
+        targets->filter[(pairs[i][0] & FILTER_MASK) >> 6] |= 1ULL << (pairs[i][0] & 63);
+    }
+    free(pairs);
+
+    return EXIT_SUCCESS;
+}
+
+void hash_targets_free(HashTargets *targets) {
+    free(targets->sorted);
+    free(targets->index);
+    targets->sorted = NULL;
+    targets->index = NULL;
+    targets->n = 0;
+}
+
+/* Searches [start, end) for the preimages of every target at once, each candidate is
+ * hashed a single time. solutions[i] is set for each target list[i] found if it was
+ * still HASH_NONE, the rest are left as they were. Returns how many were set */
+long int hash_search_multi(uint64_t start, uint64_t end, const HashTargets *targets, uint64_t *solutions, volatile sig_atomic_t *run) {
+    const HashBackend *b = hash_backend();
+    uint64_t solution;
+
+    if (end > b->modulus) end = b->modulus;
+    if (start >= end || targets->n == 0) return 0;
+
+    /* The single target kernel, without a loop over the targets */
+    if (targets->n == 1) {
+        solution = kernel(start, end, targets->sorted[0], run);
+        return (solution != HASH_NONE) ? targets_record(targets, targets->sorted[0], solution, solutions) : 0;
+    }
+
+    return multi_kernel(start, end, targets, solutions, run);
+}
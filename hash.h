@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <signal.h>
+#include <stdint.h>
+
+/* Parameters of the default backend */
+#define PRIME 99997669
+#define BIG_X 435679812
+#define BIG_Y 100001819
+
+/* Parameters of the wide backends, reduced modulo their prime */
+#define WIDE_X 0x9E3779B97F4A7C15ULL
+#define WIDE_Y 0xD1B54A32D192ED03ULL
+
+/* Keyspace width of the wide backends, in bits */
+#define WIDE_MIN_BITS 16
+#define WIDE_MAX_BITS 64
+
+/* Candidates searched between two checks of the stop flag */
+#define HASH_CHECK_EVERY (1<<16)
+
+#define HASH_NAME_LEN 16
+
+/* Up to this many targets a multi-target search compares every candidate against each
+ * of them in vector lanes, more are looked up through a filter */
+#define HASH_SIMD_TARGETS 8
+
+/* The filter has a bit per value of a hash's low bits, 8 KB */
+#define HASH_FILTER_BITS 16
+
+/* Returned when a search finds no solution. Never a hash value, every modulus is
+ * below 2^64 - 1 */
+#define HASH_NONE UINT64_MAX
+
+typedef uint64_t (*hash_kernel_fn)(uint64_t start, uint64_t end, uint64_t target, volatile sig_atomic_t *run);
+
+/* Targets of a multi-target search, see hash_targets_init */
+typedef struct _HashTargets {
+    int n;
+    uint64_t *sorted; /* Increasing, all below the modulus */
+    int *index; /* Position of sorted[i] in the list given */
+    uint64_t filter[(1 << HASH_FILTER_BITS)/64]; /* Bit (h mod 2^HASH_FILTER_BITS) set for every target h */
+} HashTargets;
+
+typedef long int (*hash_multi_fn)(uint64_t start, uint64_t end, const HashTargets *targets, uint64_t *solutions, volatile sig_atomic_t *run);
+
+/* A hash family with fixed parameters. The hash is a bijection on the keyspace
+ * [0, modulus). Narrow backends (modulus < 2^31) have every function specialized
+ * for their constants and search with 32 bit lanes. Wide backends ("wide<bits>")
+ * take the largest prime below 2^bits at run time and search with 64 bit lanes */
+typedef struct _HashBackend {
+    const char *name;
+    const char *family;
+    uint64_t modulus;
+    uint64_t multiplier;
+    uint64_t addend;
+    uint64_t (*hash)(uint64_t number);
+    hash_kernel_fn search_scalar;
+    hash_kernel_fn search_avx2;
+    hash_kernel_fn search_avx512;
+    void (*invert_range)(uint32_t *table, long int start, long int end); /* table[hash(i)] = i */
+    void (*hash_batch)(const uint64_t *numbers, uint64_t *hashes, long int n);
+    hash_multi_fn search_multi_scalar;
+    hash_multi_fn search_multi_avx2;
+    hash_multi_fn search_multi_avx512;
+} HashBackend;
+
+int hash_setup(const char *backend_name);
+void hash_list_backends(FILE *stream);
+const HashBackend *hash_backend();
+const char *hash_kernel_name();
+uint64_t hash_keyspace();
+uint64_t simple_hash(uint64_t number);
+int hash_verify(uint64_t solution, uint64_t target);
+uint64_t hash_search(uint64_t start, uint64_t end, uint64_t target, volatile sig_atomic_t *run);
+void hash_batch(const uint64_t *numbers, uint64_t *hashes, long int n);
+void hash_invert_range(uint32_t *table, long int start, long int end);
+int hash_targets_init(HashTargets *targets, const uint64_t *list, int n);
+void hash_targets_free(HashTargets *targets);
+long int hash_search_multi(uint64_t start, uint64_t end, const HashTargets *targets, uint64_t *solutions, volatile sig_atomic_t *run);
@@ -0,0 +1,264 @@
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "hash.h"
+#include "log.h"
+#include "index.h"
+
+#define TRUE 1
+#define FALSE 0
+
+#define INDEX_SIZE (sizeof(IndexHeader) + (size_t)hash_keyspace()*sizeof(uint32_t))
+
+
+struct builder_args_struct {
+    uint32_t *table;
+    long start;
+    long end;
+};
+
+
+
+
+/**************
+ ** Building **
+ **************/
+
+/* Private */
+void *builder_main_loop(struct builder_args_struct *args) {
+    hash_invert_range(args->table, args->start, args->end);
+    pthread_exit(NULL);
+}
+
+/* Private */
+int build_table(IndexHeader *header, int n_threads) {
+    pthread_t threads[n_threads];
+    struct builder_args_struct b_args[n_threads];
+    int i, error, f = FALSE;
+
+    /* Every thread inverts a disjoint range of preimages, so no two threads write
+     * the same table entry */
+    for (i=0; i<n_threads; i++) {
+        b_args[i].table = (uint32_t*)(header + 1);
+        b_args[i].start = hash_keyspace()*i/n_threads;
+        b_args[i].end = hash_keyspace()*(i+1)/n_threads;
+        error = pthread_create(threads+i, NULL, (void*) builder_main_loop, b_args+i);
+        if (error != 0) {
+            fprintf(stderr, "Error: could not start index builder\npthread_create: %s\n", strerror(error));
+            f = TRUE;
+            break;
+        }
+    }
+
+    for (i--; i>=0; i--) pthread_join(threads[i], NULL);
+
+    if (f) return EXIT_FAILURE;
+
+    header->version = INDEX_VERSION;
+    header->modulus = hash_backend()->modulus;
+    header->multiplier = hash_backend()->multiplier;
+    header->addend = hash_backend()->addend;
+    header->entries = hash_keyspace();
+    strncpy(header->backend, hash_backend()->name, sizeof(header->backend)-1);
+    /* Readers check the magic number first, it must be visible after the table */
+    __atomic_store_n(&(header->magic), INDEX_MAGIC, __ATOMIC_RELEASE);
+
+    return EXIT_SUCCESS;
+}
+
+/* Private */
+int build_file(const char *path, int n_threads) {
+    char tmp_path[4096];
+    IndexHeader *header;
+    int fd;
+
+    /* Built under a temporary name and renamed, so a half written table is never seen */
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", path, getpid());
+
+    if ((fd = open(tmp_path, O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) == -1) {
+        perror("Error: could not create preimage index file\nopen");
+        return EXIT_FAILURE;
+    }
+
+    if (ftruncate(fd, INDEX_SIZE) == -1) {
+        perror("Error: could not truncate preimage index file\nftruncate");
+        close(fd);
+        unlink(tmp_path);
+        return EXIT_FAILURE;
+    }
+
+    header = mmap(NULL, INDEX_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (header == MAP_FAILED) {
+        perror("Error: could not map preimage index file\nmmap");
+        unlink(tmp_path);
+        return EXIT_FAILURE;
+    }
+
+    if (build_table(header, n_threads) != EXIT_SUCCESS || msync(header, INDEX_SIZE, MS_SYNC) == -1) {
+        munmap(header, INDEX_SIZE);
+        unlink(tmp_path);
+        return EXIT_FAILURE;
+    }
+    munmap(header, INDEX_SIZE);
+
+    if (rename(tmp_path, path) == -1) {
+        perror("Error: could not rename preimage index file\nrename");
+        unlink(tmp_path);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/* Private */
+int build_shm(const char *name, int n_threads, PreimageIndex *index) {
+    IndexHeader *header;
+    int fd;
+
+    if ((fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR)) == -1) {
+        if (errno == EEXIST) return INDEX_NOT_READY; /* Another miner created it first */
+        perror("Error: could not create preimage index on shared memory\nshm_open");
+        return EXIT_FAILURE;
+    }
+
+    if (ftruncate(fd, INDEX_SIZE) == -1) {
+        perror("Error: could not truncate preimage index shared memory\nftruncate");
+        close(fd);
+        shm_unlink(name);
+        return EXIT_FAILURE;
+    }
+
+    header = mmap(NULL, INDEX_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (header == MAP_FAILED) {
+        perror("Error: could not map preimage index\nmmap");
+        shm_unlink(name);
+        return EXIT_FAILURE;
+    }
+
+    if (build_table(header, n_threads) != EXIT_SUCCESS) {
+        munmap(header, INDEX_SIZE);
+        shm_unlink(name);
+        return EXIT_FAILURE;
+    }
+
+    index->header = header;
+    index->table = (uint32_t*)(header + 1);
+    index->size = INDEX_SIZE;
+
+    return EXIT_SUCCESS;
+}
+
+
+
+
+/******************
+ ** Public index **
+ ******************/
+
+int index_open(PreimageIndex *index, const char *name, int is_shm, int n_threads) {
+    IndexHeader *header;
+    struct stat st;
+    int fd, ret;
+
+    index->header = NULL;
+    index->table = NULL;
+    index->size = 0;
+
+    if (hash_keyspace() > INDEX_MAX_ENTRIES) {
+        fprintf(stderr, "Error: keyspace of hash backend %s is too large for a preimage index, using brute force\n", hash_backend()->name);
+        return EXIT_FAILURE;
+    }
+
+    if (is_shm) fd = shm_open(name, O_RDONLY, 0);
+    else fd = open(name, O_RDONLY);
+
+    if (fd == -1) {
+        if (errno != ENOENT) {
+            perror("Error: could not open preimage index\nopen");
+            return EXIT_FAILURE;
+        }
+
+        /* First start, build it */
+        log_debug("Building preimage index %s\n", name);
+        if (is_shm) return build_shm(name, n_threads, index);
+        if ((ret = build_file(name, n_threads)) != EXIT_SUCCESS) return ret;
+        return index_open(index, name, is_shm, n_threads);
+    }
+
+    if (fstat(fd, &st) == -1) {
+        perror("Error: could not stat preimage index\nfstat");
+        close(fd);
+        return EXIT_FAILURE;
+    }
+
+    /* Shared memory segment created but not truncated yet */
+    if (is_shm && st.st_size == 0) {
+        close(fd);
+        return INDEX_NOT_READY;
+    }
+
+    if ((size_t)st.st_size != INDEX_SIZE) {
+        fprintf(stderr, "Error: preimage index %s has a wrong size, using brute force\n", name);
+        close(fd);
+        return EXIT_FAILURE;
+    }
+
+    header = mmap(NULL, INDEX_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (header == MAP_FAILED) {
+        perror("Error: could not map preimage index\nmmap");
+        return EXIT_FAILURE;
+    }
+
+    if (__atomic_load_n(&(header->magic), __ATOMIC_ACQUIRE) != INDEX_MAGIC) {
+        munmap(header, INDEX_SIZE);
+        if (is_shm) return INDEX_NOT_READY; /* Still being built */
+        fprintf(stderr, "Error: %s is not a preimage index, using brute force\n", name);
+        return EXIT_FAILURE;
+    }
+
+    if (header->version != INDEX_VERSION || header->modulus != hash_backend()->modulus
+        || header->multiplier != hash_backend()->multiplier || header->addend != hash_backend()->addend
+        || header->entries != hash_keyspace() || strncmp(header->backend, hash_backend()->name, sizeof(header->backend)) != 0) {
+        fprintf(stderr, "Error: preimage index %s has version %u or hash parameters not matching this miner, using brute force\n", name, header->version);
+        munmap(header, INDEX_SIZE);
+        return EXIT_FAILURE;
+    }
+
+    index->header = header;
+    index->table = (uint32_t*)(header + 1);
+    index->size = INDEX_SIZE;
+
+    return EXIT_SUCCESS;
+}
+
+uint64_t index_lookup(const PreimageIndex *index, uint64_t target) {
+    uint64_t solution;
+
+    /* The table covers the keyspace of the backend it was built for, whatever the
+     * miner's backend is now */
+    if (index->table == NULL || target >= index->header->entries
+        || target >= (index->size - sizeof(IndexHeader))/sizeof(uint32_t)
+        || strncmp(index->header->backend, hash_backend()->name, sizeof(index->header->backend)) != 0) return HASH_NONE;
+
+    /* A damaged table must not make the miner publish a wrong solution */
+    solution = index->table[target];
+    if (!hash_verify(solution, target)) return HASH_NONE;
+
+    return solution;
+}
+
+void index_close(PreimageIndex *index) {
+    if (index->header != NULL) munmap(index->header, index->size);
+    index->header = NULL;
+    index->table = NULL;
+    index->size = 0;
+}
@@ -0,0 +1,32 @@
+#include <stdint.h>
+#include <stddef.h>
+
+#define INDEX_MAGIC 0x58444950 /* "PIDX" */
+#define INDEX_VERSION 2
+
+/* Larger keyspaces are always searched by brute force (1 GiB table) */
+#define INDEX_MAX_ENTRIES (1L<<28)
+
+/* index_open return value when another miner is still building the segment */
+#define INDEX_NOT_READY 2
+
+typedef struct _IndexHeader {
+    uint32_t magic; /* Written last, once the table is complete */
+    uint32_t version;
+    uint64_t modulus;
+    uint64_t multiplier;
+    uint64_t addend;
+    uint64_t entries;
+    char backend[16]; /* Hash backend the table inverts */
+    uint64_t reserved;
+} IndexHeader;
+
+typedef struct _PreimageIndex {
+    IndexHeader *header; /* NULL if the index is not mapped */
+    uint32_t *table; /* table[h] is the preimage of h */
+    size_t size;
+} PreimageIndex;
+
+int index_open(PreimageIndex *index, const char *name, int is_shm, int n_threads);
+uint64_t index_lookup(const PreimageIndex *index, uint64_t target);
+void index_close(PreimageIndex *index);
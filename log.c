@@ -0,0 +1,239 @@
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "log.h"
+
+#define TRUE 1
+#define FALSE 0
+
+/* Bytes the flusher writes at once, at most */
+#define LOG_BATCH (1<<16)
+
+
+/* Slot i is free for the line number seq when seq == i (mod LOG_SLOTS), and holds
+ * line seq-1 once seq is one past it */
+struct log_slot_struct {
+    uint64_t seq;
+    int len;
+    char text[LOG_LINE_LEN];
+};
+
+/* Lock-free bounded ring, many producers (any thread of the process) and one
+ * consumer (the flusher). Producers never block nor make system calls */
+struct log_struct {
+    struct log_slot_struct slots[LOG_SLOTS];
+    uint64_t head; /* Next line number to claim, producers */
+    uint64_t tail; /* Next line number to write out, flusher */
+    uint64_t dropped; /* Lines lost because the ring was full */
+    uint32_t wake; /* Futex word, increased to wake the flusher early */
+    int running;
+    int stop;
+    pthread_t flusher;
+};
+
+
+
+
+/**********************
+ ** Global variables **
+ **********************/
+static struct log_struct log_ring;
+static int log_level = LOG_LEVEL; /* Lines of a level above it are dropped */
+
+
+
+
+/*************
+ ** Flusher **
+ *************/
+
+/* Private */
+void log_wake() {
+    __atomic_add_fetch(&(log_ring.wake), 1, __ATOMIC_RELEASE);
+    syscall(SYS_futex, &(log_ring.wake), FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/* Private. Writes all of buffer, retrying on signals */
+void write_all(const char *buffer, size_t len) {
+    ssize_t n;
+
+    while (len > 0) {
+        n = write(STDOUT_FILENO, buffer, len);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) return;
+        buffer += n;
+        len -= n;
+    }
+}
+
+/* Private. Writes out every complete line in the ring, returns how many */
+int drain() {
+    static char batch[LOG_BATCH];
+    struct log_slot_struct *slot;
+    size_t len = 0;
+    uint64_t dropped;
+    int n = 0;
+
+    for (;;) {
+        slot = log_ring.slots + (log_ring.tail & (LOG_SLOTS-1));
+        if (__atomic_load_n(&(slot->seq), __ATOMIC_ACQUIRE) != log_ring.tail + 1) break;
+
+        if (len + slot->len > LOG_BATCH) {
+            write_all(batch, len);
+            len = 0;
+        }
+        memcpy(batch+len, slot->text, slot->len);
+        len += slot->len;
+
+        /* Free for the line that goes LOG_SLOTS after this one */
+        __atomic_store_n(&(slot->seq), log_ring.tail + LOG_SLOTS, __ATOMIC_RELEASE);
+        __atomic_store_n(&(log_ring.tail), log_ring.tail + 1, __ATOMIC_RELEASE);
+        n++;
+    }
+
+    dropped = __atomic_exchange_n(&(log_ring.dropped), 0, __ATOMIC_RELAXED);
+    if (dropped > 0 && len + 64 <= LOG_BATCH) len += snprintf(batch+len, 64, "(%lu log lines dropped)\n", (unsigned long) dropped);
+
+    if (len > 0) write_all(batch, len);
+
+    return n;
+}
+
+/* Private */
+void *flusher_main_loop(void *args) {
+    struct timespec interval = {0, LOG_FLUSH_MS*1000000L};
+    uint32_t seen;
+
+    (void) args;
+    for (;;) {
+        seen = __atomic_load_n(&(log_ring.wake), __ATOMIC_ACQUIRE);
+        drain();
+        if (__atomic_load_n(&(log_ring.stop), __ATOMIC_ACQUIRE)) break;
+        syscall(SYS_futex, &(log_ring.wake), FUTEX_WAIT, seen, &interval, NULL, 0);
+    }
+
+    drain();
+
+    pthread_exit(NULL);
+}
+
+
+
+
+/*************
+ ** Logging **
+ *************/
+
+/* Starts the flusher, lines of a level above the given one are dropped from now on.
+ * Until then, and once stopped, lines are written at once */
+int log_start(int level) {
+    sigset_t mask, old_mask;
+    int i, error;
+
+    log_level = level;
+    if (log_ring.running) return EXIT_SUCCESS;
+
+    for (i=0; i<LOG_SLOTS; i++) log_ring.slots[i].seq = i;
+    log_ring.head = 0;
+    log_ring.tail = 0;
+    log_ring.dropped = 0;
+    log_ring.stop = FALSE;
+
+    /* Like the workers, the flusher never takes SIGINT from the main thread */
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &mask, &old_mask);
+    error = pthread_create(&(log_ring.flusher), NULL, flusher_main_loop, NULL);
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+
+    if (error != 0) {
+        fprintf(stderr, "Error: could not start log flusher\npthread_create: %s\n", strerror(error));
+        return EXIT_FAILURE;
+    }
+
+    fflush(stdout);
+    log_ring.running = TRUE;
+    atexit(log_stop);
+
+    return EXIT_SUCCESS;
+}
+
+void log_write(int level, const char *format, ...) {
+    struct log_slot_struct *slot;
+    uint64_t pos, seq;
+    va_list args;
+    int len;
+
+    if (level > log_level) return;
+
+    va_start(args, format);
+
+    if (!log_ring.running) {
+        vfprintf(stdout, format, args);
+        va_end(args);
+        return;
+    }
+
+    /* Claim the next line number whose slot is free */
+    pos = __atomic_load_n(&(log_ring.head), __ATOMIC_RELAXED);
+    for (;;) {
+        slot = log_ring.slots + (pos & (LOG_SLOTS-1));
+        seq = __atomic_load_n(&(slot->seq), __ATOMIC_ACQUIRE);
+        if (seq == pos) {
+            if (__atomic_compare_exchange_n(&(log_ring.head), &pos, pos+1, TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+        }
+        else if ((int64_t)(seq - pos) < 0) {
+            /* Full */
+            __atomic_add_fetch(&(log_ring.dropped), 1, __ATOMIC_RELAXED);
+            va_end(args);
+            return;
+        }
+        else pos = __atomic_load_n(&(log_ring.head), __ATOMIC_RELAXED);
+    }
+
+    len = vsnprintf(slot->text, LOG_LINE_LEN, format, args);
+    va_end(args);
+    if (len < 0) len = 0;
+    if (len >= LOG_LINE_LEN) {
+        len = LOG_LINE_LEN-1;
+        slot->text[len-1] = '\n';
+    }
+    slot->len = len;
+
+    __atomic_store_n(&(slot->seq), pos+1, __ATOMIC_RELEASE);
+}
+
+/* Waits until every line logged so far is written out */
+void log_flush() {
+    struct timespec pause = {0, 1000000L};
+    uint64_t head = __atomic_load_n(&(log_ring.head), __ATOMIC_ACQUIRE);
+
+    if (!log_ring.running) {
+        fflush(stdout);
+        return;
+    }
+
+    while ((int64_t)(__atomic_load_n(&(log_ring.tail), __ATOMIC_ACQUIRE) - head) < 0) {
+        log_wake();
+        nanosleep(&pause, NULL);
+    }
+}
+
+/* Writes out what is left and stops the flusher */
+void log_stop() {
+    if (!log_ring.running) return;
+
+    __atomic_store_n(&(log_ring.stop), TRUE, __ATOMIC_RELEASE);
+    log_wake();
+    pthread_join(log_ring.flusher, NULL);
+    log_ring.running = FALSE;
+}
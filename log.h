@@ -0,0 +1,26 @@
+#include <stdint.h>
+
+/* Levels, lower is more important */
+#define LOG_INFO 1
+#define LOG_DEBUG 2
+
+/* Lines of a level above it are compiled out. Build with -DLOG_LEVEL=LOG_INFO to
+ * strip debug lines */
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_DEBUG
+#endif
+
+/* Lines the ring holds, a power of 2. Lines logged while it is full are dropped */
+#define LOG_SLOTS 4096
+/* Longer lines are truncated */
+#define LOG_LINE_LEN 192
+/* The flusher writes out what was logged at least this often */
+#define LOG_FLUSH_MS 20
+
+#define log_info(...) do { if (LOG_LEVEL >= LOG_INFO) log_write(LOG_INFO, __VA_ARGS__); } while (0)
+#define log_debug(...) do { if (LOG_LEVEL >= LOG_DEBUG) log_write(LOG_DEBUG, __VA_ARGS__); } while (0)
+
+int log_start(int level);
+void log_write(int level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+void log_flush();
+void log_stop();
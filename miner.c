@@ -1,3 +1,4 @@
+#define _GNU_SOURCE /* mremap */
 #include <stdio.h>
 #include <fcntl.h>
 #include <errno.h>
@@ -6,27 +7,34 @@
 #include <string.h>
 #include <mqueue.h>
 #include <stdlib.h>
+#include <inttypes.h>
 #include <unistd.h>
 #include <pthread.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <sys/types.h>
-#include <semaphore.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <limits.h>
+#include <poll.h>
 #include "miner.h"
+#include "hash.h"
+#include "log.h"
+#include "stats.h"
+#include "shard.h"
 
-#define PRIME 99997669
-#define BIG_X 435679812
-#define BIG_Y 100001819
 #define TRUE 1
 #define FALSE 0
 
 
-struct worker_args_struct {
-    long target;
-    long start;
-    long end;
-    long solution;
+/* This process' mapping of the registry segment */
+struct registry_struct {
+    RegistryPage *pages;
+    int n_pages;
+    uint32_t generation; /* Net's registry_generation when it was mapped */
+    int *wallets; /* A wallet per slot mapped, where publish_block builds checkpoints */
+    int n_wallets;
 };
 
 
@@ -36,7 +44,11 @@ struct worker_args_struct {
  ** Global variables **
  **********************/
 static volatile sig_atomic_t active = TRUE;
-static volatile sig_atomic_t flag = TRUE;
+static volatile sig_atomic_t flag = TRUE; /* Cleared by SIGINT, stops the search */
+static struct registry_struct registry = {NULL, 0, 0, NULL, 0};
+static Stats stats = {NULL, NULL};
+static MinerStats *miner_stats = NULL; /* This miner's slot in stats, NULL if not recorded */
+static uint32_t owed_epoch = 0; /* Round closed at this epoch is the last one this miner took part in */
 
 
 
@@ -44,11 +56,8 @@ static volatile sig_atomic_t flag = TRUE;
 /*********************
  ** Signal handlers **
  *********************/
-void sigusr2_handler(int sig) {
-    flag = FALSE;
-}
-
 void sigint_handler(int sig) {
+    (void) sig;
     flag = FALSE;
     active = FALSE;
 }
@@ -62,90 +71,182 @@ void sigint_handler(int sig) {
 
 int main(int argc, char **argv) {
     NetData *net_data;
-    Block *plast_block = NULL; /* Last block of the blockchain pointer. Allows access to all the chain */
+    Chain chain; /* Net's blockchain, shared by every miner */
     Block *shm_block; /* Pointer to shared memeory segment */
-    int miner_index; /* To free miners_pid position on shared memory later */
+    int miner_index; /* To free the registry slot on shared memory later */
     int win = FALSE;
     int n_workers, n_rounds;
+    Options opts;
+    PreimageIndex index;
+    ChainCheck check; /* How much of the chain this miner has validated */
 
-    srand(time(NULL));
+    srand(time(NULL) ^ getpid());
 
-    if (check_arguments(argc, argv, &n_workers, &n_rounds) != EXIT_SUCCESS) exit(EXIT_FAILURE);
+    if (check_arguments(argc, argv, &n_workers, &n_rounds, &opts) != EXIT_SUCCESS) exit(EXIT_FAILURE);
 
     if (sig_setup() != EXIT_SUCCESS) exit(EXIT_FAILURE);
 
-    if (net_register(&net_data, &shm_block, &miner_index) != EXIT_SUCCESS) exit(EXIT_FAILURE);
+    /* Written out by a background thread, rounds never wait for stdout. What is left
+     * is written out at exit */
+    if (log_start(opts.log_level) != EXIT_SUCCESS) exit(EXIT_FAILURE);
 
-    if (miner_main_loop(net_data, shm_block, &plast_block, miner_index, n_workers, n_rounds, &win) != EXIT_SUCCESS) {
-        clean(net_data, shm_block, plast_block, miner_index, &win);
-        exit(EXIT_FAILURE);
+    if (hash_setup(opts.backend_name) != EXIT_SUCCESS) exit(EXIT_FAILURE);
+
+    /* Batch mode does not join the net */
+    if (opts.batch > 0) {
+        if (mine_batch(opts.batch, n_workers, n_rounds) != EXIT_SUCCESS) exit(EXIT_FAILURE);
+        exit(EXIT_SUCCESS);
     }
 
-    print_blocks(plast_block);
+    /* Same for most of the history of a running net, only what is appended meanwhile
+     * is left to validate once joined */
+    prevalidate_chain(&check, n_workers);
 
-    if (clean(net_data, shm_block, plast_block, miner_index, &win) != EXIT_SUCCESS) exit(EXIT_FAILURE);
+    if (net_register(&net_data, &shm_block, &chain, opts.chain_name, &miner_index) != EXIT_SUCCESS) exit(EXIT_FAILURE);
 
-    exit(EXIT_SUCCESS);
-}
+    /* The net's backend is fixed by its first miner, miners joining without -b adopt it */
+    if (strcmp(net_data->hash_backend, hash_backend()->name) != 0
+        && (opts.backend_name != NULL || hash_setup(net_data->hash_backend) != EXIT_SUCCESS)) {
+        fprintf(stderr, "Error: the net uses hash backend %s\n", net_data->hash_backend);
+        clean(net_data, shm_block, &chain, miner_index, &win);
+        exit(EXIT_FAILURE);
+    }
 
+    /* Likewise for the chain file */
+    if (opts.chain_name != NULL && strcmp(net_data->chain_name, opts.chain_name) != 0) {
+        fprintf(stderr, "Error: the net keeps its chain in %s\n", net_data->chain_name[0] != '\0' ? net_data->chain_name : "shared memory");
+        clean(net_data, shm_block, &chain, miner_index, &win);
+        exit(EXIT_FAILURE);
+    }
 
+    /* Opened once the backend is the net's one, an index is only valid for the keyspace
+     * it was built for. If it cannot be used, targets are searched by brute force */
+    index.table = NULL;
+    if (opts.index_name != NULL && index_open(&index, opts.index_name, opts.index_shm, n_workers) == EXIT_FAILURE) opts.index_name = NULL;
 
+    if (chain_validate(&chain, &check, chain.end, n_workers) != EXIT_SUCCESS) {
+        if (check.bad != 0) fprintf(stderr, "Error: invalid chain, record at offset %" PRIu64 "\n", check.bad);
+        clean(net_data, shm_block, &chain, miner_index, &win);
+        exit(EXIT_FAILURE);
+    }
 
-/* Private */
-int down(sem_t *sem) {
-    while (sem_wait(sem) != 0) {
-        if (errno != EINTR) {
-            return EXIT_FAILURE;
-        }
+    if (miner_main_loop(net_data, shm_block, &chain, miner_index, n_workers, n_rounds, &opts, &index, &win) != EXIT_SUCCESS) {
+        clean(net_data, shm_block, &chain, miner_index, &win);
+        exit(EXIT_FAILURE);
     }
 
-    return EXIT_SUCCESS;
+    /* The chain goes after every line logged during the rounds */
+    log_flush();
+    print_blocks(&chain);
+
+    if (clean(net_data, shm_block, &chain, miner_index, &win) != EXIT_SUCCESS) exit(EXIT_FAILURE);
+
+    index_close(&index);
+
+    exit(EXIT_SUCCESS);
+}
+
+/* Private. If the last owner died holding the mutex, whatever it protects is left
+ * as it was; every critical section in the net keeps it usable, or is repaired by
+ * whoever notices the death (see recover_round) */
+int lock(pthread_mutex_t *mutex) {
+    int ret = pthread_mutex_lock(mutex);
+
+    if (ret == EOWNERDEAD) ret = pthread_mutex_consistent(mutex);
+
+    return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 /* Private */
-int down_timed(sem_t *sem) {
-    struct timespec ts;
+void unlock(pthread_mutex_t *mutex) {
+    pthread_mutex_unlock(mutex);
+}
 
-    if (clock_gettime(CLOCK_REALTIME, &ts) == -1) {
-        perror("Error: could not get actual time\nclock_gettime");
-        return EXIT_FAILURE;
-    }
+/* Private. Whether a process is still running. One that exited is dead even if its
+ * parent has not reaped it yet, which kill(pid, 0) cannot tell */
+int miner_alive(pid_t pid) {
+    struct pollfd pfd;
+    int fd;
 
-    ts.tv_sec += SEM_TIMEOUT;
+    if (pid <= 0) return FALSE;
 
-    if (sem_timedwait(sem, &ts) == -1) {
-        if (errno == ETIMEDOUT) {
-            fprintf(stdout, "Max timeout reached. Aborting...\n");
-            return EXIT_SUCCESS;
-        }
-        return EXIT_FAILURE;
-    }
+    if ((fd = syscall(SYS_pidfd_open, pid, 0)) == -1) return errno != ESRCH; /* Out of fds, say alive */
+    pfd.fd = fd;
+    pfd.events = POLLIN; /* Readable once it exited */
+    pfd.revents = 0;
+    if (poll(&pfd, 1, 0) != 1) pfd.revents = 0;
+    close(fd);
 
-    return EXIT_SUCCESS;
+    return !(pfd.revents & POLLIN);
 }
 
 
 
 
+
 /*********************
  ** Check arguments **
  *********************/
-int check_arguments(int argc, char **argv, int *n_wks, int *n_rds) {
+int check_arguments(int argc, char **argv, int *n_wks, int *n_rds, Options *opts) {
+    int opt;
+
+    opts->search_order = ORDER_SEQUENTIAL;
+    opts->index_name = NULL;
+    opts->index_shm = FALSE;
+    opts->backend_name = NULL;
+    opts->chain_name = NULL;
+    opts->log_level = LOG_DEBUG;
+    opts->batch = 0;
+    opts->shard = NULL;
+
+    while ((opt = getopt(argc, argv, "o:i:Ib:w:c:qT:s:")) != -1) {
+        if (opt == 'b') opts->backend_name = optarg;
+        else if (opt == 's') opts->shard = optarg;
+        else if (opt == 'T' && atoi(optarg) > 0) opts->batch = atoi(optarg);
+        else if (opt == 'q') opts->log_level = LOG_INFO;
+        else if (opt == 'c' && strlen(optarg) < CHAIN_NAME_LEN) opts->chain_name = optarg;
+        else if (opt == 'w' && atoi(optarg) >= WIDE_MIN_BITS && atoi(optarg) <= WIDE_MAX_BITS) {
+            snprintf(opts->wide_name, sizeof(opts->wide_name), "wide%d", atoi(optarg));
+            opts->backend_name = opts->wide_name;
+        }
+        else if (opt == 'i') {
+            opts->index_name = optarg;
+            opts->index_shm = FALSE;
+        }
+        else if (opt == 'I') {
+            opts->index_name = NULL; /* Named after the shard, below */
+            opts->index_shm = TRUE;
+        }
+        else if (opt == 'o' && strcmp(optarg, "sequential") == 0) opts->search_order = ORDER_SEQUENTIAL;
+        else if (opt == 'o' && strcmp(optarg, "interleaved") == 0) opts->search_order = ORDER_INTERLEAVED;
+        else if (opt == 'o' && strcmp(optarg, "random") == 0) opts->search_order = ORDER_RANDOM;
+        else {
+            argc = 0; /* Print usage */
+            break;
+        }
+    }
 
-    if (argc < 3) {
+    if (argc - optind < 2) {
         fprintf(stderr, "Error: invalid arguments\n");
-        fprintf(stdout, "Usage: %s <number_of_workers> <number_of_rounds>\n", argv[0]);
+        fprintf(stdout, "Usage: %s [-o sequential|interleaved|random] [-i index_file | -I] [-b backend | -w bits] [-c chain_file] [-s shard] [-q] [-T chains] <number_of_workers> <number_of_rounds>\n", argv[0]);
+        fprintf(stdout, "Miners in different shards run independent nets, the shard defaults to $%s\n", SHARD_ENV);
+        fprintf(stdout, "Hash backends:\n");
+        hash_list_backends(stdout);
         return EXIT_FAILURE;
     }
 
-    *n_wks = atoi(argv[1]);
-    *n_rds = atoi(argv[2]);
+    *n_wks = atoi(argv[optind]);
+    *n_rds = atoi(argv[optind+1]);
 
     if (*n_wks > 10 || *n_wks < 1) {
         fprintf(stderr, "Error: number of workers must be a positive number greater than %d\n", MAX_WORKERS);
         return EXIT_FAILURE;
     }
 
+    /* Every segment name below depends on it */
+    if (shard_setup(opts->shard) != EXIT_SUCCESS) return EXIT_FAILURE;
+    if (opts->index_shm) opts->index_name = shard_shm(SHM_NAME_INDEX);
+
     return EXIT_SUCCESS;
 }
 
@@ -156,18 +257,13 @@ int check_arguments(int argc, char **argv, int *n_wks, int *n_rds) {
  ** Signal handlers setup **
  ***************************/
 int sig_setup() {
-    struct sigaction act1, act2;
-
-    act1.sa_handler = sigusr2_handler;
-    sigemptyset(&(act1.sa_mask));
-    act1.sa_flags = 0;
+    struct sigaction act;
 
-    act2.sa_handler = sigint_handler;
-    sigemptyset(&(act2.sa_mask));
-    act2.sa_flags = 0;
+    act.sa_handler = sigint_handler;
+    sigemptyset(&(act.sa_mask));
+    act.sa_flags = 0;
 
-    if (sigaction(SIGUSR2, &act1, NULL) < 0
-        || sigaction(SIGINT, &act2, NULL) < 0) {
+    if (sigaction(SIGINT, &act, NULL) < 0) {
         perror("Error: could not set up a signal handler.\nsigaction");
         return EXIT_FAILURE;
     }
@@ -187,11 +283,316 @@ int sig_setup() {
 **                     |-----> join_net -----> open_shm_block
  */
 
+/* Private. Grows the buffer checkpoints are built in to at least n_wallets */
+int registry_reserve(int n_wallets) {
+    int *wallets;
+
+    if (registry.n_wallets >= n_wallets) return EXIT_SUCCESS;
+
+    wallets = (int*) realloc(registry.wallets, n_wallets*sizeof(int));
+    if (wallets == NULL) {
+        perror("Error: could not alloc memory\nrealloc");
+        return EXIT_FAILURE;
+    }
+    registry.wallets = wallets;
+    registry.n_wallets = n_wallets;
+
+    return EXIT_SUCCESS;
+}
+
+/* Private. Maps the registry, or remaps it if another miner grew it since. If
+ * remapping fails the old mapping stays valid. Pages are counted before the
+ * generation is increased, a mapping is never larger than the segment */
+int registry_sync(NetData *netStruct) {
+    RegistryPage *pages;
+    uint32_t generation = __atomic_load_n(&(netStruct->registry_generation), __ATOMIC_ACQUIRE);
+    int n_pages, fd;
+
+    if (registry.pages != NULL && registry.generation == generation) return EXIT_SUCCESS;
+    n_pages = __atomic_load_n(&(netStruct->registry_pages), __ATOMIC_ACQUIRE);
+
+    if (registry.pages == NULL) {
+        if ((fd = shm_open(shard_shm(SHM_NAME_REGISTRY), O_RDWR, 0)) == -1) {
+            perror("Error: could not open miners registry on shared memory\nshm_open");
+            return EXIT_FAILURE;
+        }
+        pages = mmap(NULL, n_pages*sizeof(RegistryPage), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+    }
+    else pages = mremap(registry.pages, registry.n_pages*sizeof(RegistryPage), n_pages*sizeof(RegistryPage), MREMAP_MAYMOVE);
+
+    if (pages == MAP_FAILED) {
+        perror("Error: could not map miners registry\nmmap");
+        return EXIT_FAILURE;
+    }
+
+    registry.pages = pages;
+    registry.n_pages = n_pages;
+
+    /* Grows with the registry, checkpoints are never built on the stack. If it cannot,
+     * the generation is left behind and the next sync retries */
+    if (registry_reserve(n_pages*REGISTRY_PAGE) != EXIT_SUCCESS) return EXIT_FAILURE;
+
+    registry.generation = generation;
+
+    return EXIT_SUCCESS;
+}
+
+/* Private */
+void registry_unmap() {
+    if (registry.pages != NULL) munmap(registry.pages, registry.n_pages*sizeof(RegistryPage));
+    free(registry.wallets);
+    registry.pages = NULL;
+    registry.n_pages = 0;
+    registry.wallets = NULL;
+    registry.n_wallets = 0;
+}
+
+/* Private */
+MinerSlot *registry_slot(int miner_ind) {
+    return &(registry.pages[miner_ind / REGISTRY_PAGE].slots[miner_ind % REGISTRY_PAGE]);
+}
+
+/* Private. Whether the slot is taken, by any miner */
+int registry_used(int miner_ind) {
+    return (miner_ind / REGISTRY_PAGE < registry.n_pages)
+        && (__atomic_load_n(&(registry.pages[miner_ind / REGISTRY_PAGE].used), __ATOMIC_ACQUIRE) >> (miner_ind % REGISTRY_PAGE) & 1);
+}
+
+/* Private. Adds a page, its slots are free as the segment grows zero filled. Must be
+ * called with net_mutex held */
+int registry_grow(NetData *netStruct) {
+    int fd;
+
+    if ((fd = shm_open(shard_shm(SHM_NAME_REGISTRY), O_RDWR, 0)) == -1) {
+        perror("Error: could not open miners registry on shared memory\nshm_open");
+        return EXIT_FAILURE;
+    }
+    if (ftruncate(fd, (netStruct->registry_pages+1)*sizeof(RegistryPage)) == -1) {
+        perror("Error: could not grow miners registry\nftruncate");
+        close(fd);
+        return EXIT_FAILURE;
+    }
+    close(fd);
+
+    /* Other miners remap it the next time they use it */
+    __atomic_store_n(&(netStruct->registry_pages), netStruct->registry_pages+1, __ATOMIC_RELEASE);
+    __atomic_store_n(&(netStruct->registry_generation), netStruct->registry_generation+1, __ATOMIC_RELEASE);
+
+    return registry_sync(netStruct);
+}
+
+/* Private. Takes a free slot for this miner, without locks. The slot is claimed with
+ * a CAS on its pid and filled in before its bit is set in the page's used bitmap, so
+ * whoever walks the bitmap only sees slots ready. Only when every slot is taken a
+ * page is added, under net_mutex. Returns the miner's index, -1 on error */
+int registry_alloc(NetData *netStruct) {
+    MinerSlot *slot;
+    uint64_t free_slots;
+    pid_t pid;
+    int p, b, n_pages, ret;
+
+    while (TRUE) {
+        if (registry_sync(netStruct) != EXIT_SUCCESS) return -1;
+
+        for (p=0; p<registry.n_pages; p++) {
+            for (free_slots=~__atomic_load_n(&(registry.pages[p].used), __ATOMIC_ACQUIRE); free_slots != 0; free_slots &= free_slots-1) {
+                b = __builtin_ctzll(free_slots);
+                slot = &(registry.pages[p].slots[b]);
+
+                /* Not free yet if it is still being freed */
+                pid = 0;
+                if (!__atomic_compare_exchange_n(&(slot->pid), &pid, getpid(), FALSE, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) continue;
+
+                slot->state = SLOT_JOINING;
+                slot->slice = -1;
+                slot->wallet = 0;
+                slot->vote = -1;
+                __atomic_fetch_or(&(registry.pages[p].used), 1ULL << b, __ATOMIC_RELEASE);
+                __atomic_store_n(&(netStruct->registry_changed), TRUE, __ATOMIC_RELAXED);
+
+                return p*REGISTRY_PAGE + b;
+            }
+        }
+
+        /* Full. Whoever gets the lock first adds the page, the rest retry on it */
+        n_pages = registry.n_pages;
+        lock(&(netStruct->net_mutex));
+        ret = (netStruct->registry_pages == n_pages) ? registry_grow(netStruct) : EXIT_SUCCESS;
+        unlock(&(netStruct->net_mutex));
+        if (ret != EXIT_SUCCESS) return -1;
+    }
+}
+
+/* Private. Counts this miner in, unless the net already closed: once the last miner
+ * takes total_miners to 0 it never rises again */
+int registry_enter(NetData *netStruct) {
+    int n = __atomic_load_n(&(netStruct->total_miners), __ATOMIC_ACQUIRE);
+
+    do {
+        if (n <= 0) return FALSE;
+    } while (!__atomic_compare_exchange_n(&(netStruct->total_miners), &n, n+1, TRUE, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+    return TRUE;
+}
+
+/* Private. Last miner out, see leave_net. Miners waiting to join keep their mapping,
+ * they see the net closed and start a new one, so the mutexes they wait on are not
+ * destroyed */
+void close_net(NetData *netStruct) {
+    log_debug("Last miner, destroying net.\n");
+
+    __atomic_store_n(&(netStruct->closed), TRUE, __ATOMIC_RELEASE);
+    shm_unlink(shard_shm(SHM_NAME_BLOCK));
+    shm_unlink(shard_shm(SHM_NAME_REGISTRY));
+    shm_unlink(shard_shm(SHM_NAME_CHAIN));
+    shm_unlink(shard_shm(SHM_NAME_INDEX));
+    shm_unlink(shard_shm(SHM_NAME_STATS));
+    shm_unlink(shard_shm(SHM_NAME_NET)); /* Last, the next net may be created from now on */
+}
+
+/* Private. Every active miner gets a disjoint slice of the keyspace, numbered by its
+ * position in the registry. Other slots keep slice -1. Must be called with net_mutex
+ * held */
+void rebalance_slices(NetData *netStruct) {
+    uint64_t used;
+    MinerSlot *slot;
+    int p, n;
+
+    registry_sync(netStruct);
+    for (p=0, n=0; p<registry.n_pages; p++) {
+        for (used=__atomic_load_n(&(registry.pages[p].used), __ATOMIC_ACQUIRE); used != 0; used &= used-1) {
+            slot = &(registry.pages[p].slots[__builtin_ctzll(used)]);
+            slot->slice = (slot->state == SLOT_ACTIVE) ? n++ : -1;
+        }
+    }
+    netStruct->total_slices = n;
+}
+
+/* Private. Starts the round for the miners that joined, and leaves out those leaving.
+ * Votes are cleared for the next round. Must be called with net_mutex held, before
+ * the round is opened */
+void registry_next_round(NetData *netStruct) {
+    uint64_t used;
+    MinerSlot *slot;
+    int p;
+
+    registry_sync(netStruct);
+    for (p=0; p<registry.n_pages; p++) {
+        for (used=__atomic_load_n(&(registry.pages[p].used), __ATOMIC_ACQUIRE); used != 0; used &= used-1) {
+            slot = &(registry.pages[p].slots[__builtin_ctzll(used)]);
+            if (slot->state == SLOT_JOINING) slot->state = SLOT_ACTIVE;
+            slot->vote = -1;
+        }
+    }
+    rebalance_slices(netStruct);
+}
+
+/* Private. Miners taking part in the round. Must be called with net_mutex held */
+int registry_active(NetData *netStruct) {
+    uint64_t used;
+    int p, n;
+
+    registry_sync(netStruct);
+    for (p=0, n=0; p<registry.n_pages; p++) {
+        for (used=__atomic_load_n(&(registry.pages[p].used), __ATOMIC_ACQUIRE); used != 0; used &= used-1) {
+            n += (registry.pages[p].slots[__builtin_ctzll(used)].state == SLOT_ACTIVE);
+        }
+    }
+
+    return n;
+}
+
+/* Private. Frees the slot, without locks: out of the bitmap first, then made free for
+ * registry_alloc. Slices are left as they are until the next round, the others
+ * search the whole keyspace anyway. The miner taking total_miners to 0 closes the
+ * net, returns TRUE if it did */
+int leave_net(NetData *netStruct, int miner_ind) {
+    MinerSlot *slot = registry_slot(miner_ind);
+
+    slot->state = SLOT_FREE;
+    slot->slice = -1;
+    slot->vote = -1;
+    __atomic_fetch_and(&(registry.pages[miner_ind / REGISTRY_PAGE].used), ~(1ULL << (miner_ind % REGISTRY_PAGE)), __ATOMIC_ACQ_REL);
+    __atomic_store_n(&(netStruct->registry_changed), TRUE, __ATOMIC_RELAXED);
+    __atomic_store_n(&(slot->pid), 0, __ATOMIC_RELEASE);
+
+    if (__atomic_sub_fetch(&(netStruct->total_miners), 1, __ATOMIC_ACQ_REL) != 0) return FALSE;
+    close_net(netStruct);
+    return TRUE;
+}
+
+/* Private. Frees the slots of the miners that died, as if they had left. Returns how
+ * many of the active miners left have not arrived yet: not voted, or with updating
+ * not recorded the block. Must be called with net_mutex held, which serializes
+ * reaping; only the living free their own slots */
+int reap_dead(NetData *netStruct, int updating) {
+    int p, ind, pending = 0;
+    uint64_t used;
+    MinerSlot *slot;
+    pid_t pid;
+
+    registry_sync(netStruct);
+    for (p=0; p<registry.n_pages; p++) {
+        for (used=__atomic_load_n(&(registry.pages[p].used), __ATOMIC_ACQUIRE); used != 0; used &= used-1) {
+            ind = p*REGISTRY_PAGE + __builtin_ctzll(used);
+            slot = registry_slot(ind);
+            pid = __atomic_load_n(&(slot->pid), __ATOMIC_ACQUIRE);
+            if (pid <= 0 || pid == getpid()) continue; /* Left meanwhile */
+
+            if (!miner_alive(pid)) {
+                log_info("Miner %d died, freeing its slot\n", pid);
+                stats_reclaim(&stats, ind, pid);
+                leave_net(netStruct, ind);
+            }
+            else if (slot->state != SLOT_ACTIVE) continue;
+            else if (updating) pending += (slot->vote != VOTE_UPDATED);
+            else pending += (slot->vote == -1);
+        }
+    }
+
+    return pending;
+}
+
+/* Private. Creates the registry with a single page, slot 0 for the first miner */
+int init_registry(NetData *netStruct) {
+    int fd;
+
+    if ((fd = shm_open(shard_shm(SHM_NAME_REGISTRY), O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR)) == -1) {
+        if (errno == EEXIST) {
+            fprintf(stderr, "Error: miners registry shared memory segment already exists\n");
+        }
+        else {
+            perror("Error: could not create miners registry on shared memory\nshm_open");
+        }
+
+        return EXIT_FAILURE;
+    }
+
+    if (ftruncate(fd, sizeof(RegistryPage)) == -1) {
+        perror("Error: could not truncate shared memory size to miners registry\nftruncate");
+        close(fd);
+        shm_unlink(shard_shm(SHM_NAME_REGISTRY));
+        return EXIT_FAILURE;
+    }
+    close(fd);
+
+    netStruct->registry_pages = 1;
+    netStruct->registry_generation = 0;
+    if (registry_sync(netStruct) != EXIT_SUCCESS) {
+        shm_unlink(shard_shm(SHM_NAME_REGISTRY));
+        return EXIT_FAILURE;
+    }
+
+    /* Zero filled, every slot is free */
+    return EXIT_SUCCESS;
+}
+
 /* Private */
 int init_shm_block(Block **blockStruct) {
     int shm_block_fd;
 
-    if ((shm_block_fd = shm_open(SHM_NAME_BLOCK, O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR)) == -1) {
+    if ((shm_block_fd = shm_open(shard_shm(SHM_NAME_BLOCK), O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR)) == -1) {
         if (errno == EEXIST) {
             fprintf(stderr, "Error: block shared memory segment already exists\n");
         }
@@ -206,81 +607,149 @@ int init_shm_block(Block **blockStruct) {
     if (ftruncate(shm_block_fd, sizeof(Block))==-1) {
         perror("Error: could not truncate shared memory size to block structure\nftruncate");
         close(shm_block_fd);
-        unlink(SHM_NAME_BLOCK);
+        shm_unlink(shard_shm(SHM_NAME_BLOCK));
         return EXIT_FAILURE;
     }
 
     /* Map the memory segment. */
-    *blockStruct = mmap(NULL, sizeof(NetData), PROT_READ | PROT_WRITE, MAP_SHARED, shm_block_fd, 0);
+    *blockStruct = mmap(NULL, sizeof(Block), PROT_READ | PROT_WRITE, MAP_SHARED, shm_block_fd, 0);
     close(shm_block_fd);
     if (*blockStruct == MAP_FAILED) {
         perror("Error: could not map block structure\nmmap");
-        unlink(SHM_NAME_BLOCK);
+        shm_unlink(shard_shm(SHM_NAME_BLOCK));
         return EXIT_FAILURE;
     }
 
     (*blockStruct)->id = 1;
     (*blockStruct)->is_valid = FALSE;
-    (*blockStruct)->target = (long) ((double)rand()*(double)PRIME/(double)RAND_MAX);
-    (*blockStruct)->solution = -1;
-    (*blockStruct)->wallets[0] = 0;
-    for (int i=1; i<MAX_MINERS; i++) (*blockStruct)->wallets[i] = -1;
-    (*blockStruct)->next = NULL;
-    (*blockStruct)->prev = NULL;
+    (*blockStruct)->target = random64() % hash_keyspace();
+    (*blockStruct)->solution = HASH_NONE;
+
+    return EXIT_SUCCESS;
+}
+
+/* Private */
+int init_mutexes(NetData *netStruct) {
+    pthread_mutexattr_t attr;
+    int ret;
+
+    if ((ret = pthread_mutexattr_init(&attr)) == 0
+        && (ret = pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED)) == 0
+        && (ret = pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST)) == 0
+        && (ret = pthread_mutex_init(&(netStruct->net_mutex), &attr)) == 0
+        && (ret = pthread_mutex_init(&(netStruct->block_mutex), &attr)) == 0)
+        ret = pthread_mutex_init(&(netStruct->winner_mutex), &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    if (ret != 0) {
+        errno = ret;
+        perror("Error: could not initialize a mutex\npthread_mutex_init");
+        return EXIT_FAILURE;
+    }
 
     return EXIT_SUCCESS;
 }
 
 /* Private */
-int init_net(NetData *netStruct, Block **blockStruct, int *miner_ind) {
-
-    /* Initialize mutex */
-    if (sem_init(&(netStruct->sem_net_mutex), 1, 0) == -1
-        || sem_init(&(netStruct->sem_block_mutex), 1, 0) == -1
-        || sem_init(&(netStruct->sem_round), 1, 1) == -1
-        || sem_init(&(netStruct->sem_winner), 1, 1) == -1
-        || sem_init(&(netStruct->sem_updated), 1, 0) == -1
-        || sem_init(&(netStruct->sem_entry), 1, 1) == -1
-        || sem_init(&(netStruct->sem_voting), 1, 0) == -1
-        || sem_init(&(netStruct->sem_result), 1, 0) == -1)
-    {
-        perror("Error: could not initialize a semaphore\nsem_init");
-        shm_unlink(SHM_NAME_NET);
+int init_net(NetData *netStruct, Block **blockStruct, Chain *chain, const char *chain_name, int *miner_ind) {
+    const ChainBlock *last;
+    int *wallets;
+    int n;
+
+    /* Initialize mutexes, net and block ones locked until they are set up */
+    if (init_mutexes(netStruct) != EXIT_SUCCESS) {
+        shm_unlink(shard_shm(SHM_NAME_NET));
+        munmap(netStruct, sizeof(NetData));
+        return EXIT_FAILURE;
+    }
+    lock(&(netStruct->net_mutex));
+    lock(&(netStruct->block_mutex));
+    netStruct->closed = FALSE;
+    netStruct->layout = NET_LAYOUT;
+
+    if (init_registry(netStruct) != EXIT_SUCCESS) {
+        shm_unlink(shard_shm(SHM_NAME_REGISTRY));
+        shm_unlink(shard_shm(SHM_NAME_NET));
         munmap(netStruct, sizeof(NetData));
         return EXIT_FAILURE;
     }
 
-    netStruct->miners_pid[0] = getpid();
+    /* Empty if the chain is kept on shared memory */
+    strncpy(netStruct->chain_name, (chain_name != NULL) ? chain_name : "", sizeof(netStruct->chain_name)-1);
+    netStruct->chain_name[sizeof(netStruct->chain_name)-1] = '\0';
     netStruct->last_winner = -1;
     netStruct->current_winner = -1;
-    /* Initialize all array elements to -1, to indicate there is no active miner */
-    for (int i=1; i<MAX_MINERS; i++) netStruct->miners_pid[i] = -1;
+    netStruct->round_epoch = 0;
+    netStruct->result_seq = 0;
+    netStruct->votes.count = 0;
+    netStruct->votes.wanted = UINT32_MAX;
+    netStruct->updated.count = 0;
+    netStruct->updated.wanted = UINT32_MAX;
     netStruct->total_miners = 1;
-    /* Initialize all array elements to -1, to indicate it is not a valid vote */
-    for (int i=0; i<MAX_MINERS; i++) netStruct->voting_pool[i] = -1;
-    *miner_ind = 0;
+    *miner_ind = registry_alloc(netStruct); /* Slot 0 */
+    registry_slot(*miner_ind)->state = SLOT_ACTIVE;
+    rebalance_slices(netStruct);
+
+    /* Last, a joiner that sees it finds the registry and slot 0 counted in */
+    __atomic_store_n(&(netStruct->ready), TRUE, __ATOMIC_RELEASE);
 
     /* Now other processes can access net data structure on shared memory when joining
      * the net, but block structure on shared memory is still restricted */
-    sem_post(&(netStruct->sem_net_mutex));
+    unlock(&(netStruct->net_mutex));
 
     if (init_shm_block(blockStruct) == EXIT_FAILURE) {
-        shm_unlink(SHM_NAME_NET);
+        shm_unlink(shard_shm(SHM_NAME_REGISTRY));
+        shm_unlink(shard_shm(SHM_NAME_NET));
+        munmap(netStruct, sizeof(NetData));
+        return EXIT_FAILURE;
+    }
+
+    /* The net runs without stats if they cannot be kept */
+    stats_create(&stats);
+
+    if (chain_create(chain, (chain_name != NULL) ? chain_name : shard_shm(SHM_NAME_CHAIN), chain_name == NULL, hash_backend()->name) == EXIT_FAILURE) {
+        stats_close(&stats);
+        shm_unlink(shard_shm(SHM_NAME_STATS));
+        shm_unlink(shard_shm(SHM_NAME_BLOCK));
+        shm_unlink(shard_shm(SHM_NAME_REGISTRY));
+        shm_unlink(shard_shm(SHM_NAME_NET));
+        munmap(*blockStruct, sizeof(Block));
         munmap(netStruct, sizeof(NetData));
         return EXIT_FAILURE;
     }
 
+    /* Set once the chain exists, miners about to join look at it to validate the chain
+     * beforehand */
+    strncpy(netStruct->hash_backend, hash_backend()->name, sizeof(netStruct->hash_backend)-1);
+    netStruct->hash_backend[sizeof(netStruct->hash_backend)-1] = '\0';
+
+    /* A resumed chain file goes on from its last block. Slot 0 takes over the balance
+     * its index has there, before any checkpoint is written from the registry */
+    if (chain->header->last_block != 0) {
+        last = chain_record(chain, chain->header->last_block);
+        (*blockStruct)->id = last->id + 1;
+        (*blockStruct)->target = last->solution;
+
+        wallets = (int*) malloc((chain->header->max_wallets + 1)*sizeof(int));
+        if (wallets != NULL) {
+            n = chain_snapshot(chain, last->id, wallets, chain->header->max_wallets);
+            if (*miner_ind < n && wallets[*miner_ind] > 0) registry_slot(*miner_ind)->wallet = wallets[*miner_ind];
+            free(wallets);
+        }
+        else perror("Error: could not alloc memory, balances start over\nmalloc");
+    }
+
     /* Now processes joining the net can also open and access block structure on shared memory */
-    sem_post(&(netStruct->sem_block_mutex));
+    unlock(&(netStruct->block_mutex));
 
     return EXIT_SUCCESS;
 }
 
 /* Private */
-int open_shm_block(Block **blockStruct, int miner_ind) {
+int open_shm_block(Block **blockStruct) {
     int shm_block_fd;
 
-    if ((shm_block_fd = shm_open(SHM_NAME_BLOCK, O_RDWR, 0)) == -1) {
+    if ((shm_block_fd = shm_open(shard_shm(SHM_NAME_BLOCK), O_RDWR, 0)) == -1) {
         perror("Error: could not open existing block structure on shared memory\nshm_open");
         return EXIT_FAILURE;
     }
@@ -293,65 +762,127 @@ int open_shm_block(Block **blockStruct, int miner_ind) {
         return EXIT_FAILURE;
     }
 
-    (*blockStruct)->wallets[miner_ind] = 0;
-
     return EXIT_SUCCESS;
 }
 
 /* Private */
-int join_net(NetData *netStruct, Block **blockStruct, int *miner_ind) {
-    int i;
-
-    down(&(netStruct->sem_entry));
+int join_net(NetData *netStruct, Block **blockStruct, Chain *chain, int *miner_ind) {
+    int is_shm = (netStruct->chain_name[0] == '\0');
 
-    down(&(netStruct->sem_net_mutex));
+    /* No lock is taken, a round being voted does not hold joins back. Whoever else is
+     * joining a closed net finds out the same way */
+    if (!registry_enter(netStruct)) {
+        munmap(netStruct, sizeof(NetData));
+        return NET_CLOSED;
+    }
 
-    for (i=0; netStruct->miners_pid[i]!=-1 && i<netStruct->total_miners+1; i++);
-    if (i >= MAX_MINERS) {
-        fprintf(stderr, "Error: max miners amount reached\n");
-        sem_post(&(netStruct->sem_net_mutex));
+    if ((*miner_ind = registry_alloc(netStruct)) == -1) {
+        fprintf(stderr, "Error: could not register miner\n");
+        if (__atomic_sub_fetch(&(netStruct->total_miners), 1, __ATOMIC_ACQ_REL) == 0) close_net(netStruct);
+        registry_unmap();
         munmap(netStruct, sizeof(NetData));
         return EXIT_FAILURE;
     }
-    netStruct->miners_pid[i] = getpid();
-    netStruct->total_miners++;
-    *miner_ind = i;
 
-    sem_post(&(netStruct->sem_net_mutex));
+    lock(&(netStruct->block_mutex));
 
-    down(&(netStruct->sem_block_mutex));
-
-    if (open_shm_block(blockStruct, *miner_ind) == EXIT_FAILURE) {
+    /* The chain is only appended to while holding block_mutex. Mapping it gives
+     * the whole history at once */
+    if (open_shm_block(blockStruct) == EXIT_FAILURE || chain_open(chain, is_shm ? shard_shm(SHM_NAME_CHAIN) : netStruct->chain_name, is_shm) == EXIT_FAILURE) {
         /* If error, revert changes and exit */
-        sem_post(&(netStruct->sem_block_mutex));
-        netStruct->miners_pid[i] = -1;
-        netStruct->total_miners--;
+        unlock(&(netStruct->block_mutex));
+        leave_net(netStruct, *miner_ind);
+        registry_unmap();
         munmap(netStruct, sizeof(NetData));
         return EXIT_FAILURE;
     }
 
-    sem_post(&(netStruct->sem_block_mutex));
+    unlock(&(netStruct->block_mutex));
+
+    /* The miner runs without stats if they cannot be kept */
+    stats_open(&stats, TRUE);
 
-    /* To enter into miner's main loop */
-    sem_post(&(netStruct->sem_round));
+    log_debug("Successfuly joined net.\n");
 
-    sem_post(&(netStruct->sem_entry));
+    return EXIT_SUCCESS;
+}
 
-    fprintf(stdout, "Successfuly joined net.\n"); /* REMOVE */
+/* Validates the chain of a running net, if any, without joining it. Only if the net
+ * uses this miner's backend; otherwise, or if anything fails, check is reset and the
+ * whole chain is validated once joined */
+void prevalidate_chain(ChainCheck *check, int n_threads) {
+    NetData *net;
+    Chain chain;
+    struct stat st;
+    int fd, is_shm;
+
+    chain_check_init(check);
+
+    if ((fd = shm_open(shard_shm(SHM_NAME_NET), O_RDONLY, 0)) == -1) return;
+    if (fstat(fd, &st) == -1 || st.st_size != (off_t) sizeof(NetData)) {
+        close(fd);
+        return;
+    }
+    net = mmap(NULL, sizeof(NetData), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (net == MAP_FAILED) return;
+
+    /* A net still being created has no backend yet. The backend is not switched here:
+     * a net with another one is adopted, and its chain validated, once joined */
+    is_shm = (net->chain_name[0] == '\0');
+    if (net->layout != NET_LAYOUT || strcmp(net->hash_backend, hash_backend()->name) != 0
+        || chain_open(&chain, is_shm ? shard_shm(SHM_NAME_CHAIN) : net->chain_name, is_shm) != EXIT_SUCCESS) {
+        munmap(net, sizeof(NetData));
+        return;
+    }
+    munmap(net, sizeof(NetData));
+
+    if (chain_validate(&chain, check, chain.header->size, n_threads) != EXIT_SUCCESS) chain_check_init(check);
+
+    chain_close(&chain);
+}
+
+/* Private. Waits for the first miner to size and initialize the net it created */
+int wait_net_ready(int shm_net_fd, NetData **netStruct) {
+    struct stat st;
+    int i;
+
+    for (i=0; fstat(shm_net_fd, &st) == 0 && st.st_size == 0; i++) {
+        if (i == SEM_TIMEOUT*1000) return EXIT_FAILURE;
+        usleep(1000);
+    }
+    if (st.st_size != (off_t) sizeof(NetData)) return NET_FOREIGN;
+
+    *netStruct = mmap(NULL, sizeof(NetData), PROT_READ | PROT_WRITE, MAP_SHARED, shm_net_fd, 0);
+    if (*netStruct == MAP_FAILED) return EXIT_FAILURE;
+
+    for (i=0; !__atomic_load_n(&((*netStruct)->ready), __ATOMIC_ACQUIRE); i++) {
+        if (i == SEM_TIMEOUT*1000) {
+            munmap(*netStruct, sizeof(NetData));
+            *netStruct = MAP_FAILED;
+            return EXIT_FAILURE;
+        }
+        usleep(1000);
+    }
+    if ((*netStruct)->layout != NET_LAYOUT) {
+        munmap(*netStruct, sizeof(NetData));
+        *netStruct = MAP_FAILED;
+        return NET_FOREIGN;
+    }
 
     return EXIT_SUCCESS;
 }
 
-int net_register(NetData **netStruct, Block **blockStruct, int *miner_ind) {
-    int shm_net_fd;
+int net_register(NetData **netStruct, Block **blockStruct, Chain *chain, const char *chain_name, int *miner_ind) {
+    int shm_net_fd, ret;
     int exist = FALSE;
 
     /* Try creating net info structure on share memory */
-    if ((shm_net_fd = shm_open(SHM_NAME_NET, O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR)) == -1) {
+    if ((shm_net_fd = shm_open(shard_shm(SHM_NAME_NET), O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR)) == -1) {
         if (errno == EEXIST) {
             exist = TRUE;
             /* If structure already exists, open it */
-            if ((shm_net_fd = shm_open(SHM_NAME_NET, O_RDWR, 0)) == -1) {
+            if ((shm_net_fd = shm_open(shard_shm(SHM_NAME_NET), O_RDWR, 0)) == -1) {
                 perror("Error: could not open existing miner net info structure on shared memory\nshm_open");
                 return EXIT_FAILURE;
             }
@@ -366,21 +897,32 @@ int net_register(NetData **netStruct, Block **blockStruct, int *miner_ind) {
     if (!exist && ftruncate(shm_net_fd, sizeof(NetData))==-1) {
         perror("Error: could not truncate shared memory size to miner net data structure\nftruncate");
         close(shm_net_fd);
-        unlink(SHM_NAME_NET);
+        shm_unlink(shard_shm(SHM_NAME_NET));
         return EXIT_FAILURE;
     }
 
-    /* Map the memory segment. */
-    *netStruct = mmap(NULL, sizeof(NetData), PROT_READ | PROT_WRITE, MAP_SHARED, shm_net_fd, 0);
+    /* Map the memory segment. A net just created may not be ready to join yet */
+    if (exist) {
+        if ((ret = wait_net_ready(shm_net_fd, netStruct)) != EXIT_SUCCESS) {
+            if (ret == NET_FOREIGN) fprintf(stderr, "Error: the net was started by a miner with another shared memory layout\n");
+            else fprintf(stderr, "Error: the net was not initialized in time\n");
+            close(shm_net_fd);
+            return EXIT_FAILURE;
+        }
+    }
+    else *netStruct = mmap(NULL, sizeof(NetData), PROT_READ | PROT_WRITE, MAP_SHARED, shm_net_fd, 0);
     close(shm_net_fd);
     if (*netStruct == MAP_FAILED) {
         perror("Error: could not map miner net info structure\nmmap");
-        if (!exist) unlink(SHM_NAME_NET); /* If I am the first miner, delete the shared memory */
+        if (!exist) shm_unlink(shard_shm(SHM_NAME_NET)); /* If I am the first miner, delete the shared memory */
         return EXIT_FAILURE;
     }
 
-    if (!exist) return init_net(*netStruct, blockStruct, miner_ind);
-    else return join_net(*netStruct, blockStruct, miner_ind);
+    if (!exist) return init_net(*netStruct, blockStruct, chain, chain_name, miner_ind);
+
+    /* The net ended meanwhile, start or join the next one */
+    if ((ret = join_net(*netStruct, blockStruct, chain, miner_ind)) == NET_CLOSED) return net_register(netStruct, blockStruct, chain, chain_name, miner_ind);
+    return ret;
 }
 
 
@@ -390,382 +932,683 @@ int net_register(NetData **netStruct, Block **blockStruct, int *miner_ind) {
  ** Mining functions **
  **********************/
 
-long int simple_hash(long int number) {
-    long int result = (number * BIG_X + BIG_Y) % PRIME;
-    return result;
+/* Private. Epoch that closes the current round: the next odd one */
+uint32_t round_end(NetData *netStruct) {
+    return __atomic_load_n(&(netStruct->round_epoch), __ATOMIC_ACQUIRE) | 1;
 }
 
-void *worker_main_loop(struct worker_args_struct *args) {
-    long i;
+/* Private */
+long futex_wait(uint32_t *word, uint32_t seen, const struct timespec *timeout) {
+    /* Returns at once if the word is no longer seen, and on signals */
+    return syscall(SYS_futex, word, FUTEX_WAIT, seen, timeout, NULL, 0);
+}
 
-    for (i=args->start; flag && i<args->end; i++) {
-        if (args->target == simple_hash(i)) {
-            flag = 0;
-            args->solution = i;
-            pthread_exit(NULL);
-        }
-    }
+/* Private */
+void futex_wake_all(uint32_t *word) {
+    syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
 
-    args->solution = -1;
-    pthread_exit(NULL);
+/* Private. Closes or opens the round. A single futex wake reaches every miner
+ * sleeping on the epoch, whatever the size of the net */
+void advance_epoch(NetData *netStruct) {
+    __atomic_fetch_add(&(netStruct->round_epoch), 1, __ATOMIC_RELEASE);
+    futex_wake_all(&(netStruct->round_epoch));
 }
 
-/* Private */
-int setup_workers(pthread_t **workers, struct worker_args_struct **w_args, int n_workers) {
+/* Private. Ends the round of a winner that died the way it would have: its block
+ * stands if it was published, the miners that died with it are freed and the next
+ * round is opened. Nothing to do while the winner is alive */
+void recover_round(NetData *netStruct, Block *blockStruct, const Chain *chain) {
+    pid_t winner = __atomic_load_n(&(netStruct->current_winner), __ATOMIC_ACQUIRE);
+    const ChainBlock *last;
 
-    *workers = (pthread_t*) malloc(n_workers*sizeof(pthread_t));
-    if (*workers == NULL) {
-        perror("Error: could not alloc memory\nmalloc");
-        return EXIT_FAILURE;
+    if (winner <= 0 || miner_alive(winner)) return;
+
+    lock(&(netStruct->block_mutex));
+    lock(&(netStruct->net_mutex));
+
+    /* Another miner may have recovered it meanwhile */
+    if (netStruct->current_winner != winner) {
+        unlock(&(netStruct->net_mutex));
+        unlock(&(netStruct->block_mutex));
+        return;
+    }
+    log_info("Winner %d died, recovering the round\n", winner);
+    reap_dead(netStruct, FALSE);
+
+    /* The chain tells, is_valid may not have been set yet */
+    last = (chain->header->last_block != 0) ? chain_record(chain, chain->header->last_block) : NULL;
+    if (last != NULL && last->id == blockStruct->id) {
+        blockStruct->id++;
+        blockStruct->target = last->solution;
+        netStruct->last_winner = winner;
     }
+    blockStruct->solution = HASH_NONE;
+    blockStruct->is_valid = FALSE;
+    netStruct->current_winner = -1;
+    registry_next_round(netStruct);
+    __atomic_store_n(&(netStruct->votes.count), 0, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&(netStruct->updated.count), 0, __ATOMIC_SEQ_CST);
+
+    /* Under net_mutex, so nobody votes or updates for the round once it is over. A
+     * winner may die before closing it, then it is closed and opened at once */
+    if ((netStruct->round_epoch & 1) == 0) advance_epoch(netStruct);
+    advance_epoch(netStruct);
+    __atomic_fetch_add(&(netStruct->result_seq), 1, __ATOMIC_RELEASE);
+    futex_wake_all(&(netStruct->result_seq));
+
+    unlock(&(netStruct->net_mutex));
+    unlock(&(netStruct->block_mutex));
+}
 
-    *w_args = (struct worker_args_struct *) malloc(n_workers*sizeof(struct worker_args_struct));
-    if (*w_args == NULL) {
-        perror("Error: could not alloc memory\nmalloc");
-        free(*workers);
-        return EXIT_FAILURE;
+/* Private. Sleeps until the epoch reaches e. A miner stopped by SIGINT does not wait
+ * for a round to be closed, nobody may close it; an open always follows a close.
+ * Every LIVENESS_MS the round's winner is checked, a dead one never opens it */
+void wait_epoch(NetData *netStruct, Block *blockStruct, const Chain *chain, uint32_t e) {
+    struct timespec interval = {0, LIVENESS_MS*1000000L};
+    uint32_t seen;
+
+    while (active || (e & 1) == 0) {
+        seen = __atomic_load_n(&(netStruct->round_epoch), __ATOMIC_ACQUIRE);
+        if ((int32_t)(seen - e) >= 0) return;
+        if (futex_wait(&(netStruct->round_epoch), seen, &interval) == -1 && errno == ETIMEDOUT) recover_round(netStruct, blockStruct, chain);
     }
+}
 
-    return EXIT_SUCCESS;
+/* Private. Adds an arrival, waking the waiter only if it completes its count */
+void counter_post(Counter *counter) {
+    uint32_t count = __atomic_add_fetch(&(counter->count), 1, __ATOMIC_SEQ_CST);
+
+    if (count >= __atomic_load_n(&(counter->wanted), __ATOMIC_SEQ_CST)) futex_wake_all(&(counter->count));
 }
 
-/* Private */
-int load_workers(pthread_t *workers, struct worker_args_struct *w_args, int n_workers, long target, long *solution, int *win) {
-    int i, f, error;
-    double div;
-
-    div = (double)PRIME/(double)n_workers;
-    f = 0;
-
-    /* Initialize workers (threads) */
-    for (i=0; flag && i<n_workers; i++) {
-        w_args[i].start = i*div;
-        w_args[i].end = (i+1)*div;
-        w_args[i].target = target;
-        w_args[i].solution = -1;
-        error = pthread_create(workers+i, NULL, (void*) worker_main_loop, w_args+i);
-        if (error != 0) {
-            fprintf(stderr, "Error: could not start worker\npthread_create: %s\n", strerror(error));
-            flag = FALSE; /* Tell other workers to end */
-            f = TRUE; /* To return error later */
-            break; /* Stop creating new threads, and join the ones created */
-        }
-    }
-
-    /* Wait for workers to end */
-    for (i--; i>=0; i--) {
-        error = pthread_join(workers[i], NULL);
-        /* If thread did not end correctly, tell other threads to end, wait for them and return error */
-        if (error != 0) {
-            fprintf(stderr, "Error: worker did not end correctly\npthread_join: %s\n", strerror(error));
-            flag = FALSE; /* Tell other active threads to end */
-            f = TRUE; /* To return error later */
-        }
-        else if (!f && w_args[i].solution > 0) {
-            /* If worker found the solution, and no error occured, update win status */
-            *solution = w_args[i].solution;
-            *win = TRUE;
+/* Private. Takes n arrivals, like n sem_waits with a single wake. Either the waiter
+ * sees the last arrival or that arrival sees wanted, both are sequentially consistent.
+ * Returns FALSE, taking none, if they did not come within ms milliseconds */
+int counter_wait(Counter *counter, int n, long ms) {
+    struct timespec interval = {ms/1000, (ms%1000)*1000000L};
+    uint64_t deadline = stats_now() + ms*1000000UL;
+    uint32_t seen;
+
+    if (n <= 0) return TRUE;
+
+    __atomic_store_n(&(counter->wanted), n, __ATOMIC_SEQ_CST);
+    while ((seen = __atomic_load_n(&(counter->count), __ATOMIC_SEQ_CST)) < (uint32_t)n) {
+        if (stats_now() >= deadline) {
+            __atomic_store_n(&(counter->wanted), UINT32_MAX, __ATOMIC_SEQ_CST);
+            return FALSE;
         }
+        futex_wait(&(counter->count), seen, &interval);
     }
+    __atomic_store_n(&(counter->wanted), UINT32_MAX, __ATOMIC_SEQ_CST);
 
-    if (f) return EXIT_FAILURE;
-    return EXIT_SUCCESS;
+    __atomic_fetch_sub(&(counter->count), n, __ATOMIC_SEQ_CST);
+    return TRUE;
+}
+
+/* Private. Takes the arrivals of every other miner in the net, votes or with updating
+ * recorded blocks. The n expected wake the winner at once; failing that the registry
+ * is checked every LIVENESS_MS, so miners that died or left without arriving are not
+ * waited for. Arrivals are posted under net_mutex, the registry agrees with them */
+void wait_arrivals(NetData *netStruct, Counter *counter, int n, int updating) {
+    while (!counter_wait(counter, n, LIVENESS_MS)) {
+        lock(&(netStruct->net_mutex));
+        if (reap_dead(netStruct, updating) == 0) {
+            __atomic_store_n(&(counter->count), 0, __ATOMIC_SEQ_CST);
+            unlock(&(netStruct->net_mutex));
+            return;
+        }
+        unlock(&(netStruct->net_mutex));
+    }
+}
+
+/* Private. Tells the winner of the round closed at epoch e this miner recorded its
+ * block. Not once the round is over, recover_round may have ended it. Must be called
+ * with net_mutex held */
+void post_updated(NetData *netStruct, int miner_ind, uint32_t e) {
+    if ((e & 1) == 0 || netStruct->round_epoch != e) return;
+
+    registry_sync(netStruct);
+    if (registry_used(miner_ind) && registry_slot(miner_ind)->pid == getpid()) registry_slot(miner_ind)->vote = VOTE_UPDATED;
+    counter_post(&(netStruct->updated));
+}
+
+/* Private. Records a phase of the round that began at start, returns when it ended */
+uint64_t phase_done(int phase, uint64_t start) {
+    uint64_t now = stats_now();
+
+    if (miner_stats != NULL) stats_record(miner_stats->phases + phase, now - start);
+    return now;
 }
 
 /* Private */
-int handle_win(NetData *netStruct, Block *blockStruct, long solution, int *n_miners) {
-    int j, k;
+int search_keyspace(struct worker_pool_struct *pool, uint64_t target, int slice, int n_slices, int order, uint32_t stop_epoch) {
+    uint64_t start, end;
+
+    if (slice < 0 || slice >= n_slices) {
+        /* Miner joined after the slices were assigned: search everything */
+        start = 0;
+        end = hash_keyspace();
+    }
+    else {
+        start = (uint64_t)((unsigned __int128)hash_keyspace()*slice/n_slices);
+        end = (uint64_t)((unsigned __int128)hash_keyspace()*(slice+1)/n_slices);
+    }
 
-    down(&(netStruct->sem_winner));
-    down(&(netStruct->sem_net_mutex));
+    /* One search over the whole keyspace starting at the slice: the pool hands out the
+     * slice's chunks in the given order, then the rest in sequence, so the round ends
+     * even if a miner left without searching its slice */
+    return load_workers(pool, target, start, end - start, order, stop_epoch);
+}
+
+/* Private */
+int handle_win(NetData *netStruct, Block *blockStruct, uint64_t solution, int *n_miners) {
+    lock(&(netStruct->winner_mutex));
+    lock(&(netStruct->net_mutex));
     if (netStruct->current_winner > 0) {
         /* Another miner has already found the solution, retry */
-        fprintf(stdout, "Another miner found already the same solution\n"); /* REMOVE */
-        sem_post(&(netStruct->sem_net_mutex));
-        sem_post(&(netStruct->sem_winner));
+        log_debug("Another miner found already the same solution\n");
+        unlock(&(netStruct->net_mutex));
+        unlock(&(netStruct->winner_mutex));
         return FALSE;
     }
     else {
-        fprintf(stdout, "Found solution: %ld\n", solution); /* REMOVE */
+        log_debug("Found solution: %" PRIu64 "\n", solution);
 
         netStruct->current_winner = getpid();
-        /* Stop other miners */
-        for (k=0, k=0; j < netStruct->total_miners && k < MAX_MINERS; k++) {
-            if (netStruct->miners_pid[k] != -1 && netStruct->miners_pid[k] != getpid()) {
-                kill(netStruct->miners_pid[k], SIGUSR2);
-                j++;
-            }
-        }
-        sem_post(&(netStruct->sem_net_mutex));
-
-        /* Now other miners must wait to enter the net */
-        down(&(netStruct->sem_entry));
-
-
-        down(&(netStruct->sem_net_mutex));
-        /* Number of miners that will participate in the voting */
-        *n_miners = netStruct->total_miners;
-        sem_post(&(netStruct->sem_net_mutex));
+        /* Stop other miners: their workers see the round closed at the end of the chunk */
+        advance_epoch(netStruct);
 
+        /* Number of miners that will participate in the voting. Miners joining from
+         * now on wait for the next round */
+        *n_miners = registry_active(netStruct);
+        unlock(&(netStruct->net_mutex));
 
-        down(&(netStruct->sem_block_mutex));
+        lock(&(netStruct->block_mutex));
         /* Write solution to shared memory block */
         blockStruct->solution = solution;
-        sem_post(&(netStruct->sem_block_mutex));
+        unlock(&(netStruct->block_mutex));
 
-        sem_post(&(netStruct->sem_winner));
+        unlock(&(netStruct->winner_mutex));
         return TRUE;
     }
 }
 
-int handle_voting(NetData *netStruct, Block *blockStruct, int miner_ind,  int n_miners) {
-    int i, v_yes, v_no, ret;
+/* Private. Records the block in the chain, crediting one coin to the winner. Full
+ * balances follow it every CHAIN_CHECKPOINT_EVERY blocks and whenever miners joined
+ * or left, so deltas alone never need to know who is in the net. They carry the last
+ * snapshot forward: miners that left keep their coins, and a miner in a reused slot
+ * takes over the balance of its index. Must be called with block_mutex and net_mutex
+ * held */
+int publish_block(NetData *netStruct, Block *blockStruct, Chain *chain, int miner_ind) {
+    int i, n, n_slots = registry.n_pages*REGISTRY_PAGE, n_wallets;
+
+    if (chain_append_block(chain, blockStruct->id, miner_ind, 1, blockStruct->target, blockStruct->solution) != EXIT_SUCCESS) return EXIT_FAILURE;
+
+    /* Taken as the check, miners joining or leaving meanwhile set it again */
+    if (__atomic_exchange_n(&(netStruct->registry_changed), FALSE, __ATOMIC_ACQ_REL) || blockStruct->id % CHAIN_CHECKPOINT_EVERY == 0) {
+        n_wallets = ((int) chain->header->max_wallets > n_slots) ? (int) chain->header->max_wallets : n_slots;
+
+        /* The block stands without it, the next block retries. So does a buffer
+         * that could not grow */
+        if (registry_reserve(n_wallets) != EXIT_SUCCESS) {
+            __atomic_store_n(&(netStruct->registry_changed), TRUE, __ATOMIC_RELAXED);
+            return EXIT_SUCCESS;
+        }
+
+        /* Last checkpoint plus the deltas since, this block included */
+        n = chain_snapshot(chain, blockStruct->id, registry.wallets, n_wallets);
+        for (i=(n > 0) ? n : 0; i<n_wallets; i++) registry.wallets[i] = -1;
+
+        for (i=0; i<n_slots; i++) {
+            if (!registry_used(i)) continue;
+            /* A new index, only its own wins since it joined are not in the chain's
+             * balances. Otherwise the slot's wallet follows the chain */
+            if (registry.wallets[i] == -1) registry.wallets[i] = registry_slot(i)->wallet;
+            else registry_slot(i)->wallet = registry.wallets[i];
+        }
+
+        if (chain_append_checkpoint(chain, blockStruct->id, registry.wallets, n_wallets) != EXIT_SUCCESS) __atomic_store_n(&(netStruct->registry_changed), TRUE, __ATOMIC_RELAXED);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int handle_voting(NetData *netStruct, Block *blockStruct, Chain *chain, int miner_ind,  int n_miners) {
+    int p, v_yes, v_no, ret;
+    uint64_t used;
+    MinerSlot *slot;
+
+    /* Grow the chain while the votes come, not under block_mutex. Only the winner
+     * appends. The registry rarely grows meanwhile, the append makes room if so */
+    chain_reserve(chain, sizeof(ChainBlock) + sizeof(ChainCheckpoint) + registry.n_pages*REGISTRY_PAGE*sizeof(int) + 8);
 
     /* Wait until every miner has voted */
-    for (i=0; i<n_miners-1; i++) down(&(netStruct->sem_voting));
+    wait_arrivals(netStruct, &(netStruct->votes), n_miners-1, FALSE);
+
+    lock(&(netStruct->block_mutex));
+    lock(&(netStruct->net_mutex));
+    registry_sync(netStruct);
 
-    for (i=0, v_yes=0, v_no=0; i<MAX_MINERS; i++) {
-        if (netStruct->voting_pool[i] == TRUE) v_yes++;
-        else if (netStruct->voting_pool[i] == FALSE) v_no++;
+    for (p=0, v_yes=0, v_no=0; p<registry.n_pages; p++) {
+        for (used=registry.pages[p].used; used != 0; used &= used-1) {
+            slot = &(registry.pages[p].slots[__builtin_ctzll(used)]);
+            if (slot->vote == TRUE) v_yes++;
+            else if (slot->vote == FALSE) v_no++;
+        }
     }
 
     if (v_yes > v_no || (v_yes==0 && v_no==0)) {
-        down(&(netStruct->sem_block_mutex));
-        blockStruct->is_valid = TRUE;
-        blockStruct->wallets[miner_ind]++;
-        sem_post(&(netStruct->sem_block_mutex));
-        ret = TRUE;
+        registry_slot(miner_ind)->wallet++;
+
+        /* Published once for the whole net, before any voter can learn the result */
+        if (publish_block(netStruct, blockStruct, chain, miner_ind) == EXIT_SUCCESS) {
+            blockStruct->is_valid = TRUE;
+            ret = TRUE;
+        }
+        else {
+            registry_slot(miner_ind)->wallet--;
+            ret = FALSE;
+        }
     }
     else {
-        fprintf(stdout, "Not enough votes, invalid solution\n");
+        log_info("Not enough votes, invalid solution\n");
         ret = FALSE;
     }
 
-    for (i=0; i<n_miners-1; i++) sem_post(&(netStruct->sem_result));
+    unlock(&(netStruct->net_mutex));
+    unlock(&(netStruct->block_mutex));
+
+    /* Every voter is woken at once */
+    __atomic_fetch_add(&(netStruct->result_seq), 1, __ATOMIC_RELEASE);
+    futex_wake_all(&(netStruct->result_seq));
 
     return ret;
 }
 
-int vote(NetData *netStruct, Block *blockStruct, int miner_ind) {
-    long solution, target;
+/* Casts this miner's vote in the round closed at end_epoch, returns TRUE if it voted
+ * in favor of the solution. result_seen is for voting_result, to tell when the result
+ * is published */
+int vote(NetData *netStruct, Block *blockStruct, const Chain *chain, int miner_ind, uint32_t end_epoch, uint64_t *solution, uint32_t *result_seen) {
+    uint64_t target;
     int ret;
 
-    /* Wait for winner to update solution */
-    down(&(netStruct->sem_winner));
+    /* Wait for the round to be closed, the winner holds winner_mutex from before closing
+     * it until the solution is written */
+    wait_epoch(netStruct, blockStruct, chain, end_epoch);
+    lock(&(netStruct->winner_mutex));
 
-    down(&(netStruct->sem_block_mutex));
-    solution = blockStruct->solution;
+    lock(&(netStruct->block_mutex));
+    *solution = blockStruct->solution;
     target = blockStruct->target;
-    sem_post(&(netStruct->sem_block_mutex));
+    unlock(&(netStruct->block_mutex));
+
+    /* Same backend as the winner, fixed for the whole net */
+    ret = hash_verify(*solution, target);
+    lock(&(netStruct->net_mutex));
+    /* Read before voting, the result cannot be published until every vote is cast */
+    *result_seen = __atomic_load_n(&(netStruct->result_seq), __ATOMIC_ACQUIRE);
+    /* Not if the round is over already, recover_round may have ended it */
+    if (netStruct->round_epoch == end_epoch) {
+        registry_sync(netStruct);
+        registry_slot(miner_ind)->vote = ret;
+        counter_post(&(netStruct->votes));
+    }
+    unlock(&(netStruct->net_mutex));
+    if (ret) log_debug("Voted in favor. solution: %" PRIu64 ", target: %" PRIu64 "\n", *solution, target);
+    else log_debug("Voted against. solution: %" PRIu64 ", target: %" PRIu64 "\n", *solution, target);
+
+    unlock(&(netStruct->winner_mutex));
 
-    if (simple_hash(solution) == target) {
-        down(&(netStruct->sem_net_mutex));
-        netStruct->voting_pool[miner_ind] = TRUE;
-        sem_post(&(netStruct->sem_net_mutex));
-        fprintf(stdout, "Voted in favor. solution: %ld, target: %ld\n", solution, target); /* REMOVE */
+    return ret;
+}
+
+int voting_result(NetData *netStruct, Block *blockStruct, const Chain *chain, uint32_t end_epoch, uint32_t result_seen) {
+    struct timespec interval = {0, LIVENESS_MS*1000000L};
+    uint32_t seen;
+    int ret;
+
+    /* Wait until voting's result is known. A round over without it was never won,
+     * the winner waits for every voter when the block is valid */
+    while ((seen = __atomic_load_n(&(netStruct->result_seq), __ATOMIC_ACQUIRE)) == result_seen
+           && __atomic_load_n(&(netStruct->round_epoch), __ATOMIC_ACQUIRE) == end_epoch) {
+        if (futex_wait(&(netStruct->result_seq), seen, &interval) == -1 && errno == ETIMEDOUT) recover_round(netStruct, blockStruct, chain);
     }
-    else {
-        down(&(netStruct->sem_net_mutex));
-        netStruct->voting_pool[miner_ind] = FALSE;
-        sem_post(&(netStruct->sem_net_mutex));
-        fprintf(stdout, "Voted against. solution: %ld, target: %ld\n", solution, target); /* REMOVE */
+
+    lock(&(netStruct->block_mutex));
+    ret = blockStruct->is_valid && __atomic_load_n(&(netStruct->round_epoch), __ATOMIC_ACQUIRE) == end_epoch;
+    unlock(&(netStruct->block_mutex));
+
+    return ret;
+}
+
+/* Private. Starts searching the next round's target while this one is still being
+ * voted and recorded. The search is collected next round, or cancelled if the
+ * solution is rejected */
+int speculate(NetData *netStruct, struct worker_pool_struct *pool, int miner_ind, uint64_t next_target, int order, const PreimageIndex *index) {
+    int slice, n_slices;
+
+    /* Nothing to search if the index already knows the answer */
+    if (index->table != NULL && index_lookup(index, next_target) != HASH_NONE) return EXIT_SUCCESS;
+
+    lock(&(netStruct->net_mutex));
+    registry_sync(netStruct);
+    slice = registry_slot(miner_ind)->slice;
+    n_slices = netStruct->total_slices;
+    unlock(&(netStruct->net_mutex));
+
+    log_debug("Speculating on next target: %" PRIu64 "\n", next_target);
+
+    /* This round is closed, the search ends when the next one is */
+    return search_keyspace(pool, next_target, slice, n_slices, order, round_end(netStruct) + 2);
+}
+
+/* Private. A miner that joined takes part in the current round if it is still open,
+ * else it is started with the next one. Returns the epoch that opened its first round,
+ * which may be closed already: the winner counted it as a voter */
+uint32_t wait_active(NetData *netStruct, Block *blockStruct, const Chain *chain, int miner_ind) {
+    MinerSlot *slot;
+    uint32_t e;
+    int state;
+
+    while (TRUE) {
+        lock(&(netStruct->net_mutex));
+        registry_sync(netStruct);
+        slot = registry_slot(miner_ind);
+        e = netStruct->round_epoch;
+        if (slot->state == SLOT_JOINING && (e & 1) == 0) {
+            /* Miners already searching keep their old slices until the round ends; the
+             * union of both partitions still covers the whole keyspace */
+            slot->state = SLOT_ACTIVE;
+            rebalance_slices(netStruct);
+        }
+        state = slot->state;
+        unlock(&(netStruct->net_mutex));
+        if (state == SLOT_ACTIVE) return e & ~1U;
+
+        log_debug("Waiting for the round being voted to end\n");
+        wait_epoch(netStruct, blockStruct, chain, e + 1);
+    }
+}
+
+/* Mines n_chains chains at once, offline: each round, every chain's target is its
+ * last solution, and one sweep of the keyspace solves them all. Until interrupted if
+ * n_rounds <= 0, like the net's rounds */
+int mine_batch(int n_chains, int n_workers, int n_rounds) {
+    struct worker_pool_struct pool;
+    HashTargets set;
+    uint64_t *targets, *solutions, start;
+    uint32_t epoch = 0; /* No net, no rounds closed */
+    long int solved;
+    int i, round, ret = EXIT_SUCCESS;
+
+    targets = (uint64_t*) malloc(2*n_chains*sizeof(uint64_t));
+    if (targets == NULL) {
+        perror("Error: could not alloc memory\nmalloc");
+        return EXIT_FAILURE;
     }
+    solutions = targets + n_chains;
+
+    for (i=0; i<n_chains; i++) targets[i] = random64() % hash_keyspace();
 
-    sem_post(&(netStruct->sem_voting));
+    if (setup_workers(&pool, n_workers, &epoch, &flag, NULL, 0) != EXIT_SUCCESS) {
+        free(targets);
+        return EXIT_FAILURE;
+    }
 
-    sem_post(&(netStruct->sem_winner));
+    for (round=1; flag && (n_rounds <= 0 || round <= n_rounds); round++) {
+        if (hash_targets_init(&set, targets, n_chains) != EXIT_SUCCESS) {
+            ret = EXIT_FAILURE;
+            break;
+        }
 
-    /* Wait until voting's result is known */
-    down_timed(&(netStruct->sem_result));
+        for (i=0; i<n_chains; i++) solutions[i] = HASH_NONE;
+        start = stats_now();
+        solved = search_batch(&pool, &set, solutions);
+        hash_targets_free(&set);
+        if (!flag) break;
+
+        log_info("Round %d: %ld/%d targets solved in %.3f ms\n", round, solved, n_chains, (stats_now() - start)/1e6);
+        for (i=0; i<n_chains; i++) {
+            log_debug("Chain %d: target %" PRIu64 ", solution %" PRIu64 "\n", i, targets[i], solutions[i]);
+            /* A target without preimage ends its chain, a new one starts */
+            targets[i] = (solutions[i] != HASH_NONE) ? solutions[i] : random64() % hash_keyspace();
+        }
+    }
 
-    down(&(netStruct->sem_block_mutex));
-    ret = blockStruct->is_valid;
-    sem_post(&(netStruct->sem_block_mutex));
+    if (destroy_workers(&pool) != EXIT_SUCCESS) ret = EXIT_FAILURE;
+    free(targets);
 
     return ret;
 }
 
-int miner_main_loop(NetData *netStruct, Block *blockStruct, Block **pplast_block, int miner_ind, int n_workers, int n_rounds, int *win) {
-    int i, j, v_res, n_miners;
-    long target, solution;
-    pthread_t *workers;
-    struct worker_args_struct *w_args;
+int miner_main_loop(NetData *netStruct, Block *blockStruct, Chain *chain, int miner_ind, int n_workers, int n_rounds, const Options *opts, PreimageIndex *index, int *win) {
+    int i, v_res = -1, n_miners, slice, n_slices, last, in_favor;
+    uint32_t open_epoch, end_epoch, result_seen;
+    int use_index = (opts->index_name != NULL);
+    uint64_t target, solution, t;
+    struct worker_pool_struct pool;
 
-    if (setup_workers(&workers, &w_args, n_workers) != EXIT_SUCCESS) return EXIT_FAILURE;
+    miner_stats = stats_attach(&stats, miner_ind, n_workers);
+
+    if (setup_workers(&pool, n_workers, &(netStruct->round_epoch), &flag, (miner_stats != NULL) ? miner_stats->hashes : NULL, (miner_stats != NULL) ? (int) miner_stats->n_workers : 0) != EXIT_SUCCESS) return EXIT_FAILURE;
+
+    open_epoch = wait_active(netStruct, blockStruct, chain, miner_ind);
 
     /* Main loop */
     i = 0; /* Round counter */
     while (active && (n_rounds<=0 || i<n_rounds)) {
         *win = FALSE;
-        down(&(netStruct->sem_round));
+        t = stats_now();
+        wait_epoch(netStruct, blockStruct, chain, open_epoch);
+        t = phase_done(PHASE_WAIT, t);
 
-        down(&(netStruct->sem_block_mutex));
+        lock(&(netStruct->block_mutex));
         target = blockStruct->target;
-        sem_post(&(netStruct->sem_block_mutex));
+        unlock(&(netStruct->block_mutex));
 
-        fprintf(stdout, "Searching solution for block with target: %ld\n", target); /* REMOVE */
+        /* Already reached if a fast winner closed the round meanwhile */
+        end_epoch = round_end(netStruct);
 
-        if (load_workers(workers, w_args, n_workers, target, &solution, win) != EXIT_SUCCESS) {
-            free(workers);
-            free(w_args);
+        /* The registry may have grown while this miner waited */
+        lock(&(netStruct->net_mutex));
+        if (registry_sync(netStruct) != EXIT_SUCCESS) {
+            unlock(&(netStruct->net_mutex));
+            cancel_workers(&pool);
+            destroy_workers(&pool);
             return EXIT_FAILURE;
         }
+        slice = registry_slot(miner_ind)->slice;
+        n_slices = netStruct->total_slices;
+        unlock(&(netStruct->net_mutex));
+
+        log_debug("Searching solution for block with target: %" PRIu64 " (slice %d/%d)\n", target, slice+1, n_slices);
+
+        /* An index segment still being built by another miner is retried every round */
+        if (use_index && index->table == NULL
+            && index_open(index, opts->index_name, opts->index_shm, n_workers) == EXIT_FAILURE) use_index = FALSE;
+
+        /* A search speculated last round is kept only if it is for this round */
+        if (pool.running && (pool.target != target || pool.stop_epoch != end_epoch)) cancel_workers(&pool);
+
+        if (index->table != NULL && (solution = index_lookup(index, target)) != HASH_NONE) {
+            cancel_workers(&pool);
+            *win = TRUE;
+        }
+        else {
+            if (!pool.running) search_keyspace(&pool, target, slice, n_slices, opts->search_order, end_epoch);
+            collect_workers(&pool, &solution, win);
+        }
+        t = phase_done(PHASE_SEARCH, t);
 
         /* If there has been more than one winner, reduce them to just one.
          * Stop other miners, and write solution to shared memory block. */
-        if (*win == TRUE) *win = handle_win(netStruct, blockStruct, solution, &n_miners);
+        if (*win == TRUE) {
+            *win = handle_win(netStruct, blockStruct, solution, &n_miners);
+            t = phase_done(PHASE_ARBITRATION, t);
+        }
+
+        in_favor = (*win == TRUE) || vote(netStruct, blockStruct, chain, miner_ind, end_epoch, &solution, &result_seen);
+
+        /* The next target is this round's solution, search it meanwhile */
+        last = !active || (n_rounds>0 && (i+1)>=n_rounds);
+        if (!last && in_favor) speculate(netStruct, &pool, miner_ind, solution, opts->search_order, index);
 
-        if (*win == TRUE) v_res = handle_voting(netStruct, blockStruct, miner_ind, n_miners); /* Will wait for all miners to vote */
-        else v_res = vote(netStruct, blockStruct, miner_ind); /* Will end when voting result is known */
+        if (*win == TRUE) v_res = handle_voting(netStruct, blockStruct, chain, miner_ind, n_miners); /* Will wait for all miners to vote */
+        else v_res = voting_result(netStruct, blockStruct, chain, end_epoch, result_seen); /* Will end when voting result is known */
+        t = phase_done(PHASE_VOTING, t);
 
+        if (v_res != TRUE) cancel_workers(&pool);
 
         if (v_res == TRUE) {
-            fprintf(stdout, "Updating blockchain with winner's solution.\n"); /* REMOVE */
-            if (update_blockchain(netStruct, blockStruct, pplast_block) != EXIT_SUCCESS) {
+            log_debug("Updating blockchain with winner's solution.\n");
+            if (update_blockchain(netStruct, chain) != EXIT_SUCCESS) {
                 /* CdE */
-                free(workers);
-                free(w_args);
+                destroy_workers(&pool);
                 return EXIT_FAILURE;
             }
+            t = phase_done(PHASE_UPDATE, t);
 
             if (*win == TRUE) {
-                /* Wait for all miners (except winner) to update their blockchains */
-                for (j=0; j<n_miners-1; j++) down(&(netStruct->sem_updated));
+                /* Wait for all miners (except winner) to catch up with the chain, the
+                 * block cannot change before they have read the result */
+                wait_arrivals(netStruct, &(netStruct->updated), n_miners-1, TRUE);
+                phase_done(PHASE_UPDATED_WAIT, t);
+                if (miner_stats != NULL) __atomic_store_n(&(miner_stats->wins), miner_stats->wins + 1, __ATOMIC_RELAXED);
             }
             else if (active && (n_rounds<=0 || (i+1)<n_rounds)) {
                 /* If this is miner's last round, update just after cleaning and decreasing
                  * total miners, so it will not be active when the next round begins. */
-                sem_post(&(netStruct->sem_updated));
+                lock(&(netStruct->net_mutex));
+                post_updated(netStruct, miner_ind, end_epoch);
+                unlock(&(netStruct->net_mutex));
             }
         }
 
-        /* For the next round */
-        if (*win == TRUE) prepare_next_round(netStruct, blockStruct, &v_res, n_miners);
+        /* For the next round. A winner on its last round leaves the net first, so the
+         * next round is not waiting for it */
+        last = !active || (n_rounds>0 && (i+1)>=n_rounds);
+        if (*win == TRUE) prepare_next_round(netStruct, blockStruct, &v_res, miner_ind, last);
+        open_epoch = end_epoch + 1;
+        owed_epoch = end_epoch;
+        if (miner_stats != NULL) __atomic_store_n(&(miner_stats->rounds), miner_stats->rounds + 1, __ATOMIC_RELAXED);
         i++;
-        flag = TRUE;
     }
 
-    down_timed(&(netStruct->sem_round));
+    cancel_workers(&pool);
 
-    free(workers);
-    free(w_args);
+    /* Other miners owe the winner an update only if they voted a valid block, clean()
+     * will post it once they are out of the net */
+    if (*win != TRUE && v_res != TRUE) *win = TRUE;
 
-    return EXIT_SUCCESS;
+    return destroy_workers(&pool);
 }
 
-int prepare_next_round(NetData *netStruct, Block *blockStruct, int *v_res, int n_miners) {
-    int i;
+int prepare_next_round(NetData *netStruct, Block *blockStruct, int *v_res, int miner_ind, int leaving) {
 
-    down(&(netStruct->sem_block_mutex));
-    down(&(netStruct->sem_net_mutex));
+    lock(&(netStruct->block_mutex));
+    lock(&(netStruct->net_mutex));
 
     if (*v_res == TRUE) {
         blockStruct->id++ ;
         blockStruct->target = blockStruct->solution;
-        blockStruct->solution = -1;
+        blockStruct->solution = HASH_NONE;
         blockStruct->is_valid = FALSE;
         netStruct->last_winner = getpid();
     }
     else {
-        blockStruct->solution = -1;
+        blockStruct->solution = HASH_NONE;
     }
     netStruct->current_winner = -1;
-    for (i=0; i<MAX_MINERS; i++) netStruct->voting_pool[i] = -1;
+    /* Out of the rounds, its slot is freed by clean() */
+    registry_sync(netStruct);
+    if (leaving) registry_slot(miner_ind)->state = SLOT_LEAVING;
+    registry_next_round(netStruct);
 
-    sem_post(&(netStruct->sem_net_mutex));
-    sem_post(&(netStruct->sem_block_mutex));
+    /* Open the next round, every miner waiting for it starts at once. Still under
+     * net_mutex, a winner dying from here on has left nothing for recover_round */
+    advance_epoch(netStruct);
 
-
-    for (i=0; i<n_miners; i++) sem_post(&(netStruct->sem_round));
-
-    /* Now other miners can join the net */
-    sem_post(&(netStruct->sem_entry));
+    unlock(&(netStruct->net_mutex));
+    unlock(&(netStruct->block_mutex));
 
     *v_res = -1;
 
     return EXIT_SUCCESS;
 }
 
-int update_blockchain(NetData *netStruct, Block *shm_block, Block **pplast_block) {
-    Block *temp;
-
-    down(&(netStruct->sem_block_mutex));
-
-    temp = (Block*) malloc(sizeof(Block));
-    if (temp == NULL) return EXIT_FAILURE;
-    if (memcpy(temp, shm_block, sizeof(Block)) == NULL) {
-        free(temp);
-        return EXIT_FAILURE;
-    }
-
-    temp->prev = *pplast_block;
-    if (*pplast_block != NULL) (*pplast_block)->next = temp;
-
-    *pplast_block = temp;
+int update_blockchain(NetData *netStruct, Chain *chain) {
 
-    sem_post(&(netStruct->sem_block_mutex));
+    /* The winner already recorded the block, just see it. The chain is mapped whole,
+     * nothing is allocated */
+    lock(&(netStruct->block_mutex));
+    chain->end = chain->header->size;
+    unlock(&(netStruct->block_mutex));
 
     return EXIT_SUCCESS;
 }
 
-void print_blocks(Block *plast_block) {
-    Block *block = NULL;
-    int i, j;
+void print_blocks(const Chain *chain) {
+    const ChainBlock *block, *next;
+    uint64_t offset;
+    uint32_t header_wallets;
+    int i, j, n = -1, max_wallets;
+    int *wallets;
+
+    /* Read once, other miners may still append larger checkpoints. chain_open checked
+     * it, a chain damaged since is bounded all the same */
+    header_wallets = chain->header->max_wallets;
+    max_wallets = (header_wallets < CHAIN_MAX_WALLETS) ? (int) header_wallets : CHAIN_MAX_WALLETS;
+    wallets = (int*) malloc((max_wallets + 1)*sizeof(int));
+    if (wallets == NULL) {
+        perror("Error: could not alloc memory\nmalloc");
+        return;
+    }
+
+    /* Balances are rebuilt once for the first block, then carried forward */
+    for(i = 0, offset = chain->first; offset < chain->end && (block = chain_record(chain, offset)) != NULL; offset += block->size) {
+        if (block->kind != CHAIN_BLOCK) continue;
+
+        next = (offset + block->size < chain->end) ? chain_record(chain, offset + block->size) : NULL;
+        if (next != NULL && next->kind == CHAIN_CHECKPOINT) n = chain_load_checkpoint((const ChainCheckpoint*)next, wallets, max_wallets);
+        else if (n < 0) n = chain_snapshot(chain, block->id, wallets, max_wallets);
+        else if (block->winner < n && wallets[block->winner] != -1) wallets[block->winner] += block->delta;
 
-    for(i = 0, block = plast_block; block != NULL; block = block->prev, i++) {
-        printf("Block number: %d; Target: %ld;    Solution: %ld\n", block->id, block->target, block->solution);
-        for(j = 0; j < MAX_MINERS; j++) {
-            if (block->wallets[j] != -1) printf("%d: %d;         ", j, block->wallets[j]);
+        printf("Block number: %d; Target: %" PRIu64 ";    Solution: %" PRIu64 "\n", block->id, block->target, block->solution);
+        for(j = 0; j < n; j++) {
+            if (wallets[j] != -1) printf("%d: %d;         ", j, wallets[j]);
         }
         printf("\n\n\n");
+        i++;
     }
     printf("A total of %d blocks were printed\n", i);
-}
-
-int clean(NetData *netStruct, Block *blockStruct, Block *plast_block, int miner_ind, int *win) {
+    fflush(stdout); /* Lines logged later are written out past it */
 
-    down(&(netStruct->sem_block_mutex));
-
-    blockStruct->wallets[miner_ind] = -1;
-
-    sem_post(&(netStruct->sem_block_mutex));
-
-    down(&(netStruct->sem_net_mutex));
-
-    /* Tell other miners this miner is finished */
-    netStruct->miners_pid[miner_ind] = -1;
-    netStruct->total_miners--;
-
-    if (netStruct->total_miners <= 0) {
-
-        fprintf(stdout, "Last miner, destroying net.\n"); /* REMOVE */
+    free(wallets);
+}
 
-        /* Free shared memory if this is the last miner */
-        sem_destroy(&netStruct->sem_net_mutex);
-        sem_destroy(&netStruct->sem_block_mutex);
-        sem_destroy(&netStruct->sem_round);
-        sem_destroy(&netStruct->sem_winner);
-        sem_destroy(&netStruct->sem_updated);
-        sem_destroy(&netStruct->sem_entry);
-        sem_destroy(&netStruct->sem_voting);
-        sem_destroy(&netStruct->sem_result);
-        shm_unlink(SHM_NAME_NET);
-        shm_unlink(SHM_NAME_BLOCK);
-    } else {
-        sem_post(&(netStruct->sem_net_mutex));
-        if (!*win) sem_post(&(netStruct->sem_updated));
+int clean(NetData *netStruct, Block *blockStruct, Chain *chain, int miner_ind, int *win) {
 
-        fprintf(stdout, "Miner ended successfuly\n"); /* REMOVE */
+    /* Out of the rounds and updated at once, as the winner sees it, so the next round
+     * does not count this miner */
+    if (!*win) {
+        lock(&(netStruct->net_mutex));
+        registry_sync(netStruct);
+        registry_slot(miner_ind)->state = SLOT_LEAVING;
+        post_updated(netStruct, miner_ind, owed_epoch);
+        unlock(&(netStruct->net_mutex));
     }
 
+    /* Tell other miners this miner is finished. The last one destroys the net */
+    registry_sync(netStruct);
+    if (!leave_net(netStruct, miner_ind)) log_debug("Miner ended successfuly\n");
+
+    registry_unmap();
     munmap(netStruct, sizeof(NetData));
     munmap(blockStruct, sizeof(Block));
-
-    /* Free miner's blockchain */
-    for (Block *block = plast_block, *temp = NULL; block != NULL && temp != NULL; block = temp) {
-        temp = block->prev;
-        free(block);
-    }
+    chain_close(chain);
+    stats_detach(miner_stats);
+    stats_close(&stats);
 
     return EXIT_SUCCESS;
 }
@@ -1,49 +1,136 @@
 #include <unistd.h>
-#include <semaphore.h>
+#include <stddef.h>
+#include <pthread.h>
+#include "index.h"
+#include "chain.h"
+#include "pool.h"
 
 #define OK 0
 #define MAX_WORKERS 10
 
-#define SHM_NAME_NET "/netdata"
-#define SHM_NAME_BLOCK "/block"
+/* Layout of the shared segments below, a net started by another build is not joined */
+#define NET_LAYOUT 2
 
-#define MAX_MINERS 200
+/* Fields written by different miners at the same time are kept on different lines */
+#define CACHE_LINE 64
+#define CACHE_ALIGNED __attribute__((aligned(CACHE_LINE)))
+
+/* Miners per registry page, the registry grows a page at a time */
+#define REGISTRY_PAGE 64
 
 #define SEM_TIMEOUT 3
 
+/* Miners waiting on another miner check every this many ms whether it died */
+#define LIVENESS_MS 10
+
+/* join_net return value when the net ended while joining it */
+#define NET_CLOSED 2
+
+/* Returned when joining a net with another NET_LAYOUT */
+#define NET_FOREIGN 3
+
+#define CHAIN_NAME_LEN 256
+
+typedef struct _Options {
+    int search_order;
+    const char *index_name; /* Preimage index file or shared memory segment, NULL for brute force */
+    int index_shm;
+    char *backend_name; /* Hash backend, NULL to use the net's one */
+    char wide_name[16]; /* Backend name built by -w */
+    char *chain_name; /* Chain file, NULL to keep the chain on shared memory */
+    int log_level; /* LOG_INFO with -q, debug lines are not logged */
+    int batch; /* Chains mined at once offline with -T, 0 to join the net */
+    char *shard; /* Net instance, NULL for $MINER_SHARD or the default one */
+} Options;
+
+/* Counting semaphore on a futex word for a single waiter, which takes n arrivals at
+ * once and is only woken by the arrival completing them */
+typedef struct _Counter {
+    uint32_t count; /* Futex word */
+    uint32_t wanted; /* Arrivals the waiter needs, UINT32_MAX if nobody waits */
+} Counter;
+
+#define VOTE_UPDATED 2
+
+/* Slot states */
+#define SLOT_FREE 0
+#define SLOT_JOINING 1 /* Registered, takes part from the next round opened */
+#define SLOT_ACTIVE 2
+#define SLOT_LEAVING 3 /* Out of the rounds, about to free the slot */
+
+/* A miner's entry in the registry. Its index is the miner's index in the net. Every
+ * voter writes its own slot at the same time, one line each */
+typedef struct _MinerSlot {
+    pid_t pid; /* 0 if free. Taken with a CAS, see registry_alloc */
+    int state;
+    int slice; /* Keyspace slice assigned to the miner, -1 if none */
+    int wallet; /* Coins won */
+    int vote; /* TRUE, FALSE, VOTE_UPDATED once the block is recorded, or -1 if not voted this round */
+} CACHE_ALIGNED MinerSlot;
+
+typedef struct _RegistryPage {
+    uint64_t used; /* Bit i set once slots[i] belongs to a miner and is filled in */
+    MinerSlot slots[REGISTRY_PAGE];
+} RegistryPage;
+
+/* Alone in its segment, and all of it is read every round */
 typedef struct _Block {
-    int wallets[MAX_MINERS];
-    long int target;
-    long int solution;
+    uint64_t target;
+    uint64_t solution; /* HASH_NONE until the round is solved */
     int id;
     int is_valid;
-    struct _Block *next;
-    struct _Block *prev;
-} Block;
+} CACHE_ALIGNED Block;
 
+/* Laid out by who writes what. Fixed when the net is created, then only read; what
+ * net_mutex protects, written on joins, leaves and wins; and the words every miner
+ * polls or posts each round, each on its own line as are the mutexes */
 typedef struct _NetData {
-    pid_t miners_pid[MAX_MINERS];
-    char voting_pool[MAX_MINERS];
-    int total_miners;
+    /* Fixed */
+    uint32_t ready; /* Set once the first miner set up the mutexes and the registry, first in every layout */
+    uint32_t layout; /* NET_LAYOUT */
     pid_t monitor_pid;
+    char hash_backend[16]; /* Every miner in the net hashes and votes with this backend */
+    char chain_name[CHAIN_NAME_LEN]; /* Chain file, empty if the chain is on shared memory */
+
+    /* Under net_mutex, or atomic where miners join and leave without it */
+    int closed CACHE_ALIGNED; /* Set by the last miner, miners still joining start a new net */
+    int registry_pages; /* Pages in the registry segment */
+    uint32_t registry_generation; /* Increased when the registry grows, miners remap it */
+    int registry_changed; /* Miners joined or left since the last chain checkpoint */
+    int total_miners; /* Slots taken. Once the last miner takes it to 0 nobody joins */
+    int total_slices;
     pid_t current_winner;
     pid_t last_winner;
-    sem_t sem_net_mutex;
-    sem_t sem_block_mutex;
-    sem_t sem_round;
-    sem_t sem_winner;
-    sem_t sem_updated;
-    sem_t sem_entry;
-    sem_t sem_voting;
-    sem_t sem_result;
+
+    /* Every round */
+    uint32_t round_epoch CACHE_ALIGNED; /* Odd while the round is closed. Futex word, miners poll it */
+    uint32_t result_seq CACHE_ALIGNED; /* Increased when the voting result is known. Futex word */
+    Counter votes CACHE_ALIGNED; /* Votes cast, for the winner */
+    Counter updated CACHE_ALIGNED; /* Miners that recorded the block, for the winner */
+
+    /* Robust and process shared: a miner dying while holding one does not block
+     * the net, the next miner locking it takes it over */
+    pthread_mutex_t net_mutex CACHE_ALIGNED;
+    pthread_mutex_t block_mutex CACHE_ALIGNED;
+    pthread_mutex_t winner_mutex CACHE_ALIGNED;
 } NetData;
 
-int check_arguments(int argc, char **argv, int *n_wks, int *n_rds);
+_Static_assert(sizeof(pthread_mutex_t) <= CACHE_LINE, "a mutex spans more than a cache line");
+_Static_assert(sizeof(MinerSlot) == CACHE_LINE, "registry slots share cache lines");
+_Static_assert(sizeof(Block) == CACHE_LINE, "block is not a single cache line");
+_Static_assert(offsetof(NetData, ready) == 0, "ready must stay first, joiners read it before the layout");
+_Static_assert(offsetof(NetData, closed) % CACHE_LINE == 0 && offsetof(NetData, round_epoch) % CACHE_LINE == 0
+               && offsetof(NetData, net_mutex) % CACHE_LINE == 0, "net data is not laid out by cache line");
+_Static_assert(sizeof(RegistryPage) == (REGISTRY_PAGE+1)*CACHE_LINE, "registry layout changed, increase NET_LAYOUT");
+_Static_assert(sizeof(NetData) == 13*CACHE_LINE, "net data layout changed, increase NET_LAYOUT");
+
+int check_arguments(int argc, char **argv, int *n_wks, int *n_rds, Options *opts);
 int sig_setup();
-long int simple_hash(long int number);
-int net_register(NetData **netStruct, Block **blockStruct, int *miner_ind);
-int miner_main_loop(NetData *netStruct, Block *blockStruct, Block **pplast_block, int miner_ind, int n_workers, int n_rounds, int *win);
-int update_blockchain(NetData *netStruct, Block *shm_block, Block **pplast_block);
-void print_blocks(Block *plast_block);
-int prepare_next_round(NetData *netStruct, Block *blockStruct, int *v_res, int n_miners);
-int clean(NetData *netStruct, Block *blockStruct, Block *plast_block, int miner_ind, int *win);
+void prevalidate_chain(ChainCheck *check, int n_threads);
+int net_register(NetData **netStruct, Block **blockStruct, Chain *chain, const char *chain_name, int *miner_ind);
+int mine_batch(int n_chains, int n_workers, int n_rounds);
+int miner_main_loop(NetData *netStruct, Block *blockStruct, Chain *chain, int miner_ind, int n_workers, int n_rounds, const Options *opts, PreimageIndex *index, int *win);
+int update_blockchain(NetData *netStruct, Chain *chain);
+void print_blocks(const Chain *chain);
+int prepare_next_round(NetData *netStruct, Block *blockStruct, int *v_res, int miner_ind, int leaving);
+int clean(NetData *netStruct, Block *blockStruct, Chain *chain, int miner_ind, int *win);
@@ -0,0 +1,246 @@
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include "stats.h"
+#include "shard.h"
+
+#define TRUE 1
+#define FALSE 0
+
+
+/* A miner's hash count at the previous sample, for its rate */
+struct sample_struct {
+    int32_t pid;
+    uint64_t hashes;
+    uint64_t wins;
+};
+
+/* A shard's miners at the previous sample */
+struct shard_sample_struct {
+    char name[SHARD_NAME_LEN];
+    struct sample_struct miners[STATS_MAX_MINERS];
+};
+
+
+
+
+/*************
+ ** Helpers **
+ *************/
+
+/* Private. ns in a short human unit */
+void format_ns(char *buffer, size_t len, uint64_t ns) {
+    if (ns < 1000) snprintf(buffer, len, "%" PRIu64 "ns", ns);
+    else if (ns < 1000000) snprintf(buffer, len, "%.1fus", ns/1e3);
+    else if (ns < 1000000000) snprintf(buffer, len, "%.1fms", ns/1e6);
+    else snprintf(buffer, len, "%.1fs", ns/1e9);
+}
+
+/* Private. p50/p99 of every phase, "-" for phases that never happened */
+void print_phases(const Histogram *phases) {
+    char p50[16], p99[16];
+    int k;
+
+    for (k=0; k<STATS_PHASES; k++) {
+        if (phases[k].count == 0) {
+            printf(" %15s", "-");
+            continue;
+        }
+        format_ns(p50, sizeof(p50), stats_percentile(phases+k, 0.50));
+        format_ns(p99, sizeof(p99), stats_percentile(phases+k, 0.99));
+        printf(" %7s/%-7s", p50, p99);
+    }
+    printf("\n");
+}
+
+/* Private */
+void print_sample(const Stats *stats, struct sample_struct *prev, double interval) {
+    Histogram net[STATS_PHASES];
+    MinerStats miner;
+    uint64_t hashes, net_rounds = 0, net_wins = 0;
+    double rate, net_rate = 0;
+    int i, j, k, n = 0, have_rate = FALSE;
+    char rate_str[16];
+
+    memset(net, 0, sizeof(net));
+
+    printf("%5s %8s %8s %7s %9s", "miner", "pid", "rounds", "wins", "Mhash/s");
+    for (k=0; k<STATS_PHASES; k++) printf(" %15s", stats_phase_name(k));
+    printf("\n");
+
+    for (i=0; i<STATS_MAX_MINERS; i++) {
+        if (__atomic_load_n(&(stats->miners[i].pid), __ATOMIC_ACQUIRE) == 0) {
+            prev[i].pid = 0;
+            continue;
+        }
+        /* A copy, so every figure printed comes from the same read */
+        memcpy(&miner, stats->miners+i, sizeof(miner));
+        if (miner.pid == 0) continue;
+
+        for (j=0, hashes=0; j<(int)miner.n_workers && j<STATS_MAX_WORKERS; j++) hashes += miner.hashes[j];
+
+        if (prev[i].pid == miner.pid && interval > 0) {
+            rate = (hashes - prev[i].hashes)/interval/1e6;
+            snprintf(rate_str, sizeof(rate_str), "%.2f", rate);
+            net_rate += rate;
+            have_rate = TRUE;
+        }
+        else snprintf(rate_str, sizeof(rate_str), "-");
+        prev[i].pid = miner.pid;
+        prev[i].hashes = hashes;
+        prev[i].wins = miner.wins;
+
+        printf("%5d %8d %8" PRIu64 " %7" PRIu64 " %9s", i, miner.pid, miner.rounds, miner.wins, rate_str);
+        print_phases(miner.phases);
+
+        for (k=0; k<STATS_PHASES; k++) stats_merge(net+k, miner.phases+k);
+        net_rounds += miner.rounds;
+        net_wins += miner.wins;
+        n++;
+    }
+
+    if (have_rate) snprintf(rate_str, sizeof(rate_str), "%.2f", net_rate);
+    else snprintf(rate_str, sizeof(rate_str), "-");
+    printf("%5s %8d %8" PRIu64 " %7" PRIu64 " %9s", "net", n, net_rounds, net_wins, rate_str);
+    print_phases(net);
+    printf("\n");
+    fflush(stdout);
+}
+
+
+
+
+/* Private. Adds up a shard's miners into its row. Blocks are the wins of the miners
+ * in the net, rates count only miners seen at the previous sample too */
+void shard_row(const Stats *stats, struct sample_struct *prev, double interval, int *n, uint64_t *blocks, double *block_rate, double *hash_rate) {
+    MinerStats miner;
+    uint64_t hashes;
+    int i, j;
+
+    *n = 0;
+    *blocks = 0;
+    *block_rate = 0;
+    *hash_rate = 0;
+
+    for (i=0; i<STATS_MAX_MINERS; i++) {
+        if (__atomic_load_n(&(stats->miners[i].pid), __ATOMIC_ACQUIRE) == 0) {
+            prev[i].pid = 0;
+            continue;
+        }
+        /* Only the counters, not the histograms */
+        memcpy(&miner, stats->miners+i, offsetof(MinerStats, phases));
+        if (miner.pid == 0) continue;
+
+        for (j=0, hashes=0; j<(int)miner.n_workers && j<STATS_MAX_WORKERS; j++) hashes += miner.hashes[j];
+
+        if (prev[i].pid == miner.pid && interval > 0) {
+            *hash_rate += (hashes - prev[i].hashes)/interval/1e6;
+            *block_rate += (miner.wins - prev[i].wins)/interval;
+        }
+        prev[i].pid = miner.pid;
+        prev[i].hashes = hashes;
+        prev[i].wins = miner.wins;
+
+        *blocks += miner.wins;
+        (*n)++;
+    }
+}
+
+/* Private. One row per shard with a net running, and their total */
+void print_summary(struct shard_sample_struct *prev, int *n_prev, double interval) {
+    static char names[MAX_SHARDS][SHARD_NAME_LEN];
+    struct shard_sample_struct *sample;
+    Stats stats;
+    uint64_t blocks, total_blocks = 0;
+    double block_rate, hash_rate, total_block_rate = 0, total_hash_rate = 0;
+    int i, k, n, n_shards, total_miners = 0;
+
+    printf("%-16s %6s %8s %9s %9s\n", "shard", "miners", "blocks", "blocks/s", "Mhash/s");
+
+    n_shards = shard_list(SHM_NAME_STATS, names, MAX_SHARDS);
+    for (k=0; k<n_shards; k++) {
+        if (shard_setup(names[k]) != EXIT_SUCCESS || stats_open(&stats, FALSE) != EXIT_SUCCESS) continue;
+
+        /* Rates need the shard's previous sample, a shard new in the list has none */
+        for (i=0, sample=NULL; i<*n_prev; i++) {
+            if (strcmp(prev[i].name, names[k]) == 0) sample = prev + i;
+        }
+        if (sample == NULL && *n_prev < MAX_SHARDS) {
+            sample = prev + (*n_prev)++;
+            strcpy(sample->name, names[k]);
+            memset(sample->miners, 0, sizeof(sample->miners));
+            shard_row(&stats, sample->miners, 0, &n, &blocks, &block_rate, &hash_rate);
+        }
+        else if (sample != NULL) shard_row(&stats, sample->miners, interval, &n, &blocks, &block_rate, &hash_rate);
+        stats_close(&stats);
+        if (sample == NULL) continue;
+
+        printf("%-16s %6d %8" PRIu64 " %9.2f %9.2f\n", names[k][0] != '\0' ? names[k] : "(default)", n, blocks, block_rate, hash_rate);
+        total_miners += n;
+        total_blocks += blocks;
+        total_block_rate += block_rate;
+        total_hash_rate += hash_rate;
+    }
+
+    printf("%-16s %6d %8" PRIu64 " %9.2f %9.2f\n\n", "total", total_miners, total_blocks, total_block_rate, total_hash_rate);
+    fflush(stdout);
+}
+
+
+
+
+/*******************
+ ** Main function **
+ *******************/
+
+/* Prints the stats of the shard's running net every interval, count times (0 for
+ * ever) */
+int main(int argc, char **argv) {
+    Stats stats;
+    static struct sample_struct prev[STATS_MAX_MINERS];
+    static struct shard_sample_struct shards[MAX_SHARDS];
+    double interval = 1;
+    int count = 0, all = FALSE, n_shards = 0, opt, i;
+    char *shard = NULL;
+
+    while ((opt = getopt(argc, argv, "i:n:s:a")) != -1) {
+        if (opt == 'i' && atof(optarg) > 0) interval = atof(optarg);
+        else if (opt == 'n' && atoi(optarg) >= 0) count = atoi(optarg);
+        else if (opt == 's') shard = optarg;
+        else if (opt == 'a') all = TRUE;
+        else {
+            argc = 0; /* Print usage */
+            break;
+        }
+    }
+
+    if (argc == 0 || optind != argc) {
+        fprintf(stderr, "Error: invalid arguments\n");
+        fprintf(stdout, "Usage: %s [-i seconds] [-n count] [-s shard | -a]\n", argv[0]);
+        fprintf(stdout, "Latencies are p50/p99 of each phase of the rounds since the miner joined\n");
+        fprintf(stdout, "With -a, a summary of the nets in every shard\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (all) {
+        for (i=0; count == 0 || i < count; i++) {
+            if (i > 0) usleep((useconds_t)(interval*1e6));
+            print_summary(shards, &n_shards, (i > 0) ? interval : 0);
+        }
+        exit(EXIT_SUCCESS);
+    }
+
+    if (shard_setup(shard) != EXIT_SUCCESS || stats_open(&stats, FALSE) != EXIT_SUCCESS) exit(EXIT_FAILURE);
+
+    for (i=0; count == 0 || i < count; i++) {
+        if (i > 0) usleep((useconds_t)(interval*1e6));
+        print_sample(&stats, prev, (i > 0) ? interval : 0);
+    }
+
+    stats_close(&stats);
+
+    exit(EXIT_SUCCESS);
+}
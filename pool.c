@@ -0,0 +1,350 @@
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "hash.h"
+#include "pool.h"
+
+#define TRUE 1
+#define FALSE 0
+
+
+
+
+/***********
+ ** Utils **
+ ***********/
+
+/* rand() gives 31 bits, wide keyspaces need 64 */
+uint64_t random64() {
+    return ((uint64_t)rand() << 62) ^ ((uint64_t)rand() << 31) ^ (uint64_t)rand();
+}
+
+/* Whether the epoch has reached e, wrap around safe */
+int epoch_reached(uint32_t *epoch, uint32_t e) {
+    return (int32_t)(__atomic_load_n(epoch, __ATOMIC_ACQUIRE) - e) >= 0;
+}
+
+
+
+
+/*************
+ ** Workers **
+ *************/
+
+/* Private. Number of chunks covering len candidates, without overflowing near 2^64 */
+uint64_t chunks_of(uint64_t len) {
+    return len/WORK_CHUNK + (len%WORK_CHUNK != 0);
+}
+
+/* Private */
+int next_chunk(struct worker_pool_struct *pool, uint64_t *pos, uint64_t *len) {
+    unsigned long k;
+    uint64_t c, r;
+    int b;
+
+    do {
+        k = __atomic_fetch_add(&(pool->cursor), 1, __ATOMIC_RELAXED);
+        if (k >= pool->n_chunks) return FALSE;
+
+        if (k >= pool->own_chunks) {
+            /* Rest of the keyspace, in order */
+            *pos = pool->own_len + (k - pool->own_chunks)*WORK_CHUNK;
+            *len = (pool->keyspace - *pos < WORK_CHUNK) ? pool->keyspace - *pos : WORK_CHUNK;
+            return TRUE;
+        }
+
+        if (pool->order == ORDER_RANDOM) {
+            c = (uint64_t)(((unsigned __int128)k*pool->stride + pool->offset) % pool->own_chunks);
+        }
+        else if (pool->order == ORDER_INTERLEAVED) {
+            for (b=0, r=0; b<pool->rev_bits; b++) r |= ((k >> b) & 1) << (pool->rev_bits-1-b);
+            c = r;
+        }
+        else c = k;
+    } while (c >= chunks_of(pool->own_len)); /* Bit-reversed numbers past the slice */
+
+    *pos = c*WORK_CHUNK;
+    *len = (pool->own_len - *pos < WORK_CHUNK) ? pool->own_len - *pos : WORK_CHUNK;
+
+    return TRUE;
+}
+
+void *worker_main_loop(struct worker_args_struct *args) {
+    struct worker_pool_struct *pool = args->pool;
+    unsigned long seen = 0;
+    uint64_t pos, len, start, solution;
+    long int found;
+
+    pthread_mutex_lock(&(pool->mutex));
+    while (TRUE) {
+        /* Sleep until the miner hands out a new search or shuts the pool down */
+        while (!pool->shutdown && pool->generation == seen) pthread_cond_wait(&(pool->cond_start), &(pool->mutex));
+        if (pool->shutdown) break;
+        seen = pool->generation;
+        pthread_mutex_unlock(&(pool->mutex));
+
+        /* Take chunks until the keyspace is exhausted, another worker finds the solution,
+         * the search is cancelled or the round is closed. The epoch is polled once per
+         * chunk, a load from a cache line only written twice a round */
+        args->solution = HASH_NONE;
+        while (*(pool->run) && !__atomic_load_n(&(pool->stop), __ATOMIC_RELAXED) && !epoch_reached(pool->epoch, pool->stop_epoch) && next_chunk(pool, &pos, &len)) {
+            /* base + pos (mod keyspace), which may not fit in 64 bits */
+            start = (pos >= pool->keyspace - pool->base) ? pos - (pool->keyspace - pool->base) : pool->base + pos;
+
+            solution = HASH_NONE;
+            if (pool->targets != NULL) {
+                /* Batch: every candidate of the chunk is checked against all the targets */
+                found = hash_search_multi(start, (len > pool->keyspace - start) ? pool->keyspace : start + len, pool->targets, pool->solutions, pool->run);
+                if (len > pool->keyspace - start) found += hash_search_multi(0, len - (pool->keyspace - start), pool->targets, pool->solutions, pool->run);
+                if (found > 0 && __atomic_sub_fetch(&(pool->remaining), found, __ATOMIC_RELAXED) <= 0) __atomic_store_n(&(pool->stop), TRUE, __ATOMIC_RELAXED);
+            }
+            else if (len > pool->keyspace - start) {
+                /* Chunk wraps around the end of the keyspace */
+                solution = hash_search(start, pool->keyspace, pool->target, pool->run);
+                if (solution == HASH_NONE) solution = hash_search(0, len - (pool->keyspace - start), pool->target, pool->run);
+            }
+            else solution = hash_search(start, start + len, pool->target, pool->run);
+
+            /* Once per chunk, whole chunks even if the search stopped within it */
+            if (args->hashes != NULL) __atomic_store_n(args->hashes, *(args->hashes) + len, __ATOMIC_RELAXED);
+
+            if (solution != HASH_NONE) {
+                args->solution = solution;
+                __atomic_store_n(&(pool->stop), TRUE, __ATOMIC_RELAXED);
+            }
+        }
+
+        pthread_mutex_lock(&(pool->mutex));
+        if (--pool->pending == 0) pthread_cond_signal(&(pool->cond_done));
+    }
+    pthread_mutex_unlock(&(pool->mutex));
+
+    pthread_exit(NULL);
+}
+
+
+
+
+/**********
+ ** Pool **
+ **********/
+
+/* Joins every worker and frees the pool */
+int destroy_workers(struct worker_pool_struct *pool) {
+    int i, error, f = FALSE;
+
+    pthread_mutex_lock(&(pool->mutex));
+    pool->shutdown = TRUE;
+    pthread_cond_broadcast(&(pool->cond_start));
+    pthread_mutex_unlock(&(pool->mutex));
+
+    for (i=0; i<pool->n_workers; i++) {
+        error = pthread_join(pool->workers[i], NULL);
+        if (error != 0) {
+            fprintf(stderr, "Error: worker did not end correctly\npthread_join: %s\n", strerror(error));
+            f = TRUE;
+        }
+    }
+
+    pthread_cond_destroy(&(pool->cond_start));
+    pthread_cond_destroy(&(pool->cond_done));
+    pthread_mutex_destroy(&(pool->mutex));
+    free(pool->workers);
+    free(pool->w_args);
+
+    if (f) return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
+
+/* Starts n_workers threads waiting for a search. Worker i adds the candidates it
+ * searches to hashes[i] if i < n_hashes, run is cleared to end every search */
+int setup_workers(struct worker_pool_struct *pool, int n_workers, uint32_t *epoch, volatile sig_atomic_t *run, uint64_t *hashes, int n_hashes) {
+    pthread_condattr_t attr;
+    sigset_t mask, old_mask;
+    int error;
+
+    pool->workers = (pthread_t*) malloc(n_workers*sizeof(pthread_t));
+    if (pool->workers == NULL) {
+        perror("Error: could not alloc memory\nmalloc");
+        return EXIT_FAILURE;
+    }
+
+    pool->w_args = (struct worker_args_struct *) malloc(n_workers*sizeof(struct worker_args_struct));
+    if (pool->w_args == NULL) {
+        perror("Error: could not alloc memory\nmalloc");
+        free(pool->workers);
+        return EXIT_FAILURE;
+    }
+
+    pthread_mutex_init(&(pool->mutex), NULL);
+    pthread_cond_init(&(pool->cond_start), NULL);
+    /* wait_workers has monotonic deadlines */
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&(pool->cond_done), &attr);
+    pthread_condattr_destroy(&attr);
+    pool->targets = NULL;
+    pool->generation = 0;
+    pool->pending = 0;
+    pool->shutdown = FALSE;
+    pool->running = FALSE;
+    pool->epoch = epoch;
+    pool->run = run;
+
+    /* Workers inherit a mask blocking SIGINT, so its handler always runs on the main
+     * thread and interrupts the miner's waits rather than a worker's search */
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &mask, &old_mask);
+
+    /* Threads are created once and live until destroy_workers */
+    for (pool->n_workers=0; pool->n_workers<n_workers; pool->n_workers++) {
+        pool->w_args[pool->n_workers].pool = pool;
+        pool->w_args[pool->n_workers].hashes = (hashes != NULL && pool->n_workers < n_hashes) ? hashes + pool->n_workers : NULL;
+        error = pthread_create(pool->workers+pool->n_workers, NULL, (void*) worker_main_loop, pool->w_args+pool->n_workers);
+        if (error != 0) {
+            fprintf(stderr, "Error: could not start worker\npthread_create: %s\n", strerror(error));
+            pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+            destroy_workers(pool); /* Join the ones created */
+            return EXIT_FAILURE;
+        }
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+
+    return EXIT_SUCCESS;
+}
+
+
+
+
+/************
+ ** Search **
+ ************/
+
+/* Private */
+uint64_t gcd(uint64_t a, uint64_t b) {
+    uint64_t t;
+
+    while (b != 0) {
+        t = a % b;
+        a = b;
+        b = t;
+    }
+
+    return a;
+}
+
+/* Hands a search out to the workers, collect_workers waits for it */
+int load_workers(struct worker_pool_struct *pool, uint64_t target, uint64_t base, uint64_t own_len, int order, uint32_t stop_epoch) {
+    int i;
+
+    pthread_mutex_lock(&(pool->mutex));
+
+    pool->target = target;
+    pool->keyspace = hash_keyspace();
+    pool->base = base;
+    pool->own_len = own_len;
+    pool->own_chunks = chunks_of(own_len);
+    pool->order = order;
+    pool->cursor = 0;
+    __atomic_store_n(&(pool->stop), FALSE, __ATOMIC_RELAXED);
+    pool->stop_epoch = stop_epoch;
+
+    if (order == ORDER_INTERLEAVED) {
+        for (pool->rev_bits=0; (1UL << pool->rev_bits) < pool->own_chunks; pool->rev_bits++);
+        pool->own_chunks = 1UL << pool->rev_bits;
+    }
+    else if (order == ORDER_RANDOM) {
+        /* Any stride coprime with the number of chunks gives a permutation */
+        do {
+            pool->stride = 1 + random64() % pool->own_chunks;
+        } while (gcd(pool->stride, pool->own_chunks) != 1);
+        pool->offset = random64() % pool->own_chunks;
+    }
+
+    pool->n_chunks = pool->own_chunks + chunks_of(pool->keyspace - own_len);
+
+    for (i=0; i<pool->n_workers; i++) pool->w_args[i].solution = HASH_NONE;
+
+    /* Start the search on every worker */
+    pool->pending = pool->n_workers;
+    pool->running = TRUE;
+    pool->generation++;
+    pthread_cond_broadcast(&(pool->cond_start));
+
+    pthread_mutex_unlock(&(pool->mutex));
+
+    return EXIT_SUCCESS;
+}
+
+/* Waits until the current search ends or the monotonic deadline passes, whichever
+ * comes first. Returns TRUE if the search ended, collect_workers then returns at once */
+int wait_workers(struct worker_pool_struct *pool, const struct timespec *deadline) {
+    int ended;
+
+    pthread_mutex_lock(&(pool->mutex));
+    while (pool->pending > 0 && pthread_cond_timedwait(&(pool->cond_done), &(pool->mutex), deadline) != ETIMEDOUT);
+    ended = (pool->pending == 0);
+    pthread_mutex_unlock(&(pool->mutex));
+
+    return ended;
+}
+
+/* Waits for every worker to end the current search */
+int collect_workers(struct worker_pool_struct *pool, uint64_t *solution, int *win) {
+    int i;
+
+    pthread_mutex_lock(&(pool->mutex));
+
+    while (pool->pending > 0) pthread_cond_wait(&(pool->cond_done), &(pool->mutex));
+    pool->running = FALSE;
+
+    for (i=0; i<pool->n_workers; i++) {
+        if (pool->w_args[i].solution != HASH_NONE) {
+            /* If worker found the solution, update win status */
+            *solution = pool->w_args[i].solution;
+            *win = TRUE;
+        }
+    }
+
+    pthread_mutex_unlock(&(pool->mutex));
+
+    return EXIT_SUCCESS;
+}
+
+/* Stops the current search, if any, and discards its result */
+void cancel_workers(struct worker_pool_struct *pool) {
+    uint64_t solution;
+    int win;
+
+    if (!pool->running) return;
+
+    __atomic_store_n(&(pool->stop), TRUE, __ATOMIC_RELAXED);
+    collect_workers(pool, &solution, &win);
+}
+
+/* Searches the whole keyspace once for every target in the set, solutions
+ * are set as by hash_search_multi. Returns how many targets were solved */
+long int search_batch(struct worker_pool_struct *pool, const HashTargets *targets, uint64_t *solutions) {
+    uint64_t solution;
+    int win;
+
+    if (targets->n == 0) return 0;
+
+    pool->targets = targets;
+    pool->solutions = solutions;
+    pool->remaining = targets->n;
+
+    /* Never stopped by the epoch, only by solving every target */
+    load_workers(pool, HASH_NONE, 0, hash_keyspace(), ORDER_SEQUENTIAL, *(pool->epoch) + 2);
+    collect_workers(pool, &solution, &win);
+
+    pool->targets = NULL;
+
+    return targets->n - pool->remaining;
+}
@@ -0,0 +1,63 @@
+#include <stdint.h>
+#include <signal.h>
+#include <pthread.h>
+
+/* Candidates handed out to a worker at a time */
+#define WORK_CHUNK (1<<16)
+
+/* Order in which a miner's own slice is searched */
+#define ORDER_SEQUENTIAL 0
+#define ORDER_INTERLEAVED 1 /* Bit-reversed chunks, spreads early work over the slice */
+#define ORDER_RANDOM 2 /* Random permutation of chunks, different every round */
+
+struct worker_args_struct {
+    uint64_t solution;
+    uint64_t *hashes; /* Candidates searched, in the stats segment. NULL if not recorded */
+    struct worker_pool_struct *pool;
+};
+
+/* Worker threads searching the keyspace, created once and handed a search at a time.
+ * Used by the miner, and by bench to measure the same code */
+struct worker_pool_struct {
+    pthread_t *workers;
+    struct worker_args_struct *w_args;
+    int n_workers;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond_start; /* Workers wait here for a new search */
+    pthread_cond_t cond_done; /* Miner waits here for the search to end, CLOCK_MONOTONIC */
+    unsigned long generation; /* Increased every time a new search is handed out */
+    int pending; /* Workers still searching */
+    int shutdown;
+    int running; /* A search has been handed out and not collected yet */
+    volatile sig_atomic_t *run; /* Cleared by SIGINT, ends every search */
+    int stop; /* Ends the current search only, unlike run. Read and written atomically */
+    uint32_t *epoch; /* Net's round epoch */
+    uint32_t stop_epoch; /* The search ends once the epoch reaches this value */
+    /* Current search. Positions [0, keyspace) are candidates base, base+1, ... (mod
+     * keyspace), the first own_len of them are the miner's own slice */
+    uint64_t target;
+    uint64_t keyspace;
+    uint64_t base;
+    uint64_t own_len;
+    uint64_t own_chunks; /* Cursor values for the own slice, chunks past it are sequential */
+    uint64_t n_chunks; /* Cursor values for the whole keyspace */
+    unsigned long cursor; /* Next chunk to hand out, shared by all workers */
+    int order;
+    int rev_bits; /* ORDER_INTERLEAVED: chunk numbers are bit-reversed with this width */
+    uint64_t stride; /* ORDER_RANDOM: chunk k of the slice is (k*stride + offset) mod chunks */
+    uint64_t offset;
+    /* Batch search, see search_batch. NULL when searching for target alone */
+    const struct _HashTargets *targets;
+    uint64_t *solutions; /* solutions[i] for the i-th target given to hash_targets_init */
+    long int remaining; /* Targets not solved yet, the search ends at 0 */
+};
+
+uint64_t random64();
+int epoch_reached(uint32_t *epoch, uint32_t e);
+int setup_workers(struct worker_pool_struct *pool, int n_workers, uint32_t *epoch, volatile sig_atomic_t *run, uint64_t *hashes, int n_hashes);
+int load_workers(struct worker_pool_struct *pool, uint64_t target, uint64_t base, uint64_t own_len, int order, uint32_t stop_epoch);
+int wait_workers(struct worker_pool_struct *pool, const struct timespec *deadline);
+int collect_workers(struct worker_pool_struct *pool, uint64_t *solution, int *win);
+void cancel_workers(struct worker_pool_struct *pool);
+long int search_batch(struct worker_pool_struct *pool, const struct _HashTargets *targets, uint64_t *solutions);
+int destroy_workers(struct worker_pool_struct *pool);
@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <dirent.h>
+#include "shard.h"
+
+#define TRUE 1
+#define FALSE 0
+
+/* Where shm_open creates its segments */
+#define SHM_DIR "/dev/shm"
+
+
+/* A segment's name in this process' shard */
+struct segment_struct {
+    const char *base;
+    char name[SHM_NAME_LEN];
+};
+
+
+
+
+/**********************
+ ** Global variables **
+ **********************/
+static char shard[SHARD_NAME_LEN] = ""; /* Empty for the default shard */
+static struct segment_struct segments[SHARD_SEGMENTS];
+static int n_segments = 0;
+
+
+
+
+/************
+ ** Shards **
+ ************/
+
+/* Private */
+int shard_valid(const char *name) {
+    size_t i, len = strlen(name);
+
+    if (len >= SHARD_NAME_LEN) return FALSE;
+    for (i=0; i<len; i++) {
+        if (!((name[i] >= 'a' && name[i] <= 'z') || (name[i] >= 'A' && name[i] <= 'Z')
+              || (name[i] >= '0' && name[i] <= '9') || name[i] == '_' || name[i] == '-')) return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* Picks the net this process works on: name, else $MINER_SHARD, else the default
+ * shard. Every segment of a net is named after its shard, so nets in different shards
+ * never share a round, a lock or a chain. Call before any segment is opened */
+int shard_setup(const char *name) {
+    if (name == NULL) name = getenv(SHARD_ENV);
+    if (name == NULL) name = "";
+
+    if (!shard_valid(name)) {
+        fprintf(stderr, "Error: invalid shard name %s, use up to %d letters, digits, '_' or '-'\n", name, SHARD_NAME_LEN-1);
+        return EXIT_FAILURE;
+    }
+
+    strcpy(shard, name);
+    n_segments = 0;
+
+    return EXIT_SUCCESS;
+}
+
+/* Empty for the default shard */
+const char *shard_name() {
+    return shard;
+}
+
+/* Name of segment base in this shard: base itself in the default shard, for the
+ * segments of nets started before shards existed, base.shard otherwise. Names are
+ * built once per segment, from the main thread */
+const char *shard_shm(const char *base) {
+    int i;
+
+    if (shard[0] == '\0') return base;
+
+    for (i=0; i<n_segments; i++) {
+        if (strcmp(segments[i].base, base) == 0) return segments[i].name;
+    }
+    if (n_segments == SHARD_SEGMENTS) return base; /* Not reached, there are fewer segments */
+
+    segments[n_segments].base = base;
+    snprintf(segments[n_segments].name, SHM_NAME_LEN, "%s.%s", base, shard);
+
+    return segments[n_segments++].name;
+}
+
+/* Shards with a segment named after base, the default one as "". Returns how many,
+ * at most max */
+int shard_list(const char *base, char names[][SHARD_NAME_LEN], int max) {
+    DIR *dir;
+    struct dirent *entry;
+    size_t len;
+    int n = 0;
+
+    if (base[0] == '/') base++;
+    len = strlen(base);
+
+    if ((dir = opendir(SHM_DIR)) == NULL) {
+        perror("Error: could not list shared memory segments\nopendir");
+        return 0;
+    }
+
+    while (n < max && (entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, base, len) != 0) continue;
+        if (entry->d_name[len] == '\0') names[n++][0] = '\0';
+        else if (entry->d_name[len] == '.' && entry->d_name[len+1] != '\0' && shard_valid(entry->d_name + len + 1)) strcpy(names[n++], entry->d_name + len + 1);
+    }
+
+    closedir(dir);
+
+    return n;
+}
@@ -0,0 +1,26 @@
+/* Shard a process works on, when not given on the command line */
+#define SHARD_ENV "MINER_SHARD"
+
+/* Shard names are letters, digits, '_' and '-', shorter than this */
+#define SHARD_NAME_LEN 32
+#define SHM_NAME_LEN (SHARD_NAME_LEN + 16)
+
+/* Segment names in the default shard, see shard_shm. Every program that opens a
+ * net's segments takes them from here */
+#define SHM_NAME_NET "/netdata"
+#define SHM_NAME_BLOCK "/block"
+#define SHM_NAME_INDEX "/preimage"
+#define SHM_NAME_REGISTRY "/miners"
+#define SHM_NAME_CHAIN "/chain"
+#define SHM_NAME_STATS "/stats"
+
+/* Segments looked up by shard_shm, at most */
+#define SHARD_SEGMENTS 16
+
+/* Shards listed by shard_list, at most */
+#define MAX_SHARDS 64
+
+int shard_setup(const char *name);
+const char *shard_name();
+const char *shard_shm(const char *base);
+int shard_list(const char *base, char names[][SHARD_NAME_LEN], int max);
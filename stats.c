@@ -0,0 +1,225 @@
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "stats.h"
+#include "shard.h"
+
+#define TRUE 1
+#define FALSE 0
+
+#define STATS_SIZE (sizeof(StatsHeader) + STATS_MAX_MINERS*sizeof(MinerStats))
+
+/* Single writer, readers in other processes must not see torn values */
+#define STORE(field, value) __atomic_store_n(&(field), (value), __ATOMIC_RELAXED)
+
+
+
+
+/*************
+ ** Segment **
+ *************/
+
+/* Private */
+int stats_map(Stats *stats, int fd, int writable) {
+    stats->header = mmap(NULL, STATS_SIZE, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (stats->header == MAP_FAILED) {
+        perror("Error: could not map stats\nmmap");
+        stats->header = NULL;
+        return EXIT_FAILURE;
+    }
+    stats->miners = (MinerStats*)(stats->header + 1);
+
+    return EXIT_SUCCESS;
+}
+
+/* Creates the net's stats segment, or takes over one left by a net that crashed. Its
+ * pages are only touched for the miners that ever joined */
+int stats_create(Stats *stats) {
+    int fd, i;
+
+    stats->header = NULL;
+
+    if ((fd = shm_open(shard_shm(SHM_NAME_STATS), O_CREAT | O_RDWR, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) == -1) {
+        perror("Error: could not create stats shared memory segment\nshm_open");
+        return EXIT_FAILURE;
+    }
+    if (ftruncate(fd, STATS_SIZE) == -1) {
+        perror("Error: could not truncate stats shared memory segment\nftruncate");
+        close(fd);
+        shm_unlink(shard_shm(SHM_NAME_STATS));
+        return EXIT_FAILURE;
+    }
+    if (stats_map(stats, fd, TRUE) != EXIT_SUCCESS) {
+        shm_unlink(shard_shm(SHM_NAME_STATS));
+        return EXIT_FAILURE;
+    }
+
+    for (i=0; i<STATS_MAX_MINERS; i++) {
+        if (stats->miners[i].pid != 0) stats->miners[i].pid = 0;
+    }
+
+    stats->header->version = STATS_VERSION;
+    stats->header->max_miners = STATS_MAX_MINERS;
+    stats->header->max_workers = STATS_MAX_WORKERS;
+    stats->header->n_phases = STATS_PHASES;
+    stats->header->n_buckets = STATS_BUCKETS;
+    stats->header->miner_size = sizeof(MinerStats);
+    __atomic_store_n(&(stats->header->magic), STATS_MAGIC, __ATOMIC_RELEASE);
+
+    return EXIT_SUCCESS;
+}
+
+/* Opens the net's stats segment, checking its layout is this one. STATS_NOT_READY,
+ * and no error printed, if it is still being created */
+int stats_open(Stats *stats, int writable) {
+    struct stat st;
+    int fd;
+
+    stats->header = NULL;
+
+    if ((fd = shm_open(shard_shm(SHM_NAME_STATS), writable ? O_RDWR : O_RDONLY, 0)) == -1) {
+        perror("Error: could not open stats shared memory segment\nshm_open");
+        return EXIT_FAILURE;
+    }
+    if (fstat(fd, &st) == 0 && st.st_size == 0) {
+        close(fd);
+        return STATS_NOT_READY;
+    }
+    if (fstat(fd, &st) == -1 || st.st_size != STATS_SIZE) {
+        fprintf(stderr, "Error: stats shared memory segment has a wrong size\n");
+        close(fd);
+        return EXIT_FAILURE;
+    }
+    if (stats_map(stats, fd, writable) != EXIT_SUCCESS) return EXIT_FAILURE;
+
+    if (__atomic_load_n(&(stats->header->magic), __ATOMIC_ACQUIRE) == 0) {
+        stats_close(stats);
+        return STATS_NOT_READY;
+    }
+    if (__atomic_load_n(&(stats->header->magic), __ATOMIC_ACQUIRE) != STATS_MAGIC
+        || stats->header->version != STATS_VERSION || stats->header->max_miners != STATS_MAX_MINERS
+        || stats->header->max_workers != STATS_MAX_WORKERS || stats->header->n_phases != STATS_PHASES
+        || stats->header->n_buckets != STATS_BUCKETS || stats->header->miner_size != sizeof(MinerStats)) {
+        fprintf(stderr, "Error: stats shared memory segment has another layout\n");
+        stats_close(stats);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/* Clears the slot of a miner that joined, NULL if it is not recorded */
+MinerStats *stats_attach(Stats *stats, int miner_ind, int n_workers) {
+    MinerStats *miner;
+
+    if (stats->header == NULL || miner_ind < 0 || miner_ind >= STATS_MAX_MINERS) return NULL;
+
+    miner = stats->miners + miner_ind;
+    __atomic_store_n(&(miner->pid), 0, __ATOMIC_RELEASE);
+    memset((char*)miner + sizeof(miner->pid), 0, sizeof(MinerStats) - sizeof(miner->pid));
+    miner->n_workers = (n_workers < STATS_MAX_WORKERS) ? n_workers : STATS_MAX_WORKERS;
+    __atomic_store_n(&(miner->pid), getpid(), __ATOMIC_RELEASE);
+
+    return miner;
+}
+
+/* Frees the slot, unless a miner that joined since has taken it over */
+void stats_detach(MinerStats *miner) {
+    int32_t pid = getpid();
+
+    if (miner != NULL) __atomic_compare_exchange_n(&(miner->pid), &pid, 0, FALSE, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+
+/* Frees the slot of a miner that died, the same way */
+void stats_reclaim(Stats *stats, int miner_ind, int32_t pid) {
+    if (stats->header == NULL || miner_ind < 0 || miner_ind >= STATS_MAX_MINERS) return;
+
+    __atomic_compare_exchange_n(&(stats->miners[miner_ind].pid), &pid, 0, FALSE, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+
+void stats_close(Stats *stats) {
+    if (stats->header == NULL) return;
+    munmap(stats->header, STATS_SIZE);
+    stats->header = NULL;
+}
+
+
+
+
+/****************
+ ** Histograms **
+ ****************/
+
+/* Monotonic time in ns */
+uint64_t stats_now() {
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec*1000000000UL + t.tv_nsec;
+}
+
+/* Private */
+int bucket_of(uint64_t ns) {
+    int msb;
+
+    if (ns < 4) return ns;
+    msb = 63 - __builtin_clzll(ns);
+    return 4*(msb-1) + ((ns >> (msb-2)) & 3);
+}
+
+/* Private. Largest value of bucket b */
+uint64_t bucket_top(int b) {
+    int msb = b/4 + 1;
+
+    if (b < 4) return b;
+    return ((uint64_t)(4 + b%4) << (msb-2)) + (1UL << (msb-2)) - 1;
+}
+
+void stats_record(Histogram *histogram, uint64_t ns) {
+    int b = bucket_of(ns);
+
+    STORE(histogram->buckets[b], histogram->buckets[b] + 1);
+    STORE(histogram->sum, histogram->sum + ns);
+    if (ns > histogram->max) STORE(histogram->max, ns);
+    STORE(histogram->count, histogram->count + 1);
+}
+
+void stats_merge(Histogram *into, const Histogram *histogram) {
+    int b;
+
+    for (b=0; b<STATS_BUCKETS; b++) into->buckets[b] += __atomic_load_n(&(histogram->buckets[b]), __ATOMIC_RELAXED);
+    into->sum += __atomic_load_n(&(histogram->sum), __ATOMIC_RELAXED);
+    into->count += __atomic_load_n(&(histogram->count), __ATOMIC_RELAXED);
+    if (histogram->max > into->max) into->max = histogram->max;
+}
+
+/* Upper bound of the p-th quantile (0 < p <= 1), within 25%. 0 if empty */
+uint64_t stats_percentile(const Histogram *histogram, double p) {
+    uint64_t total = 0, seen = 0, wanted;
+    int b;
+
+    for (b=0; b<STATS_BUCKETS; b++) total += histogram->buckets[b];
+    if (total == 0) return 0;
+
+    wanted = (uint64_t)(p*total + 0.5);
+    if (wanted == 0) wanted = 1;
+    for (b=0; b<STATS_BUCKETS; b++) {
+        seen += histogram->buckets[b];
+        if (seen >= wanted) break;
+    }
+
+    return (bucket_top(b) < histogram->max) ? bucket_top(b) : histogram->max;
+}
+
+const char *stats_phase_name(int phase) {
+    static const char *names[STATS_PHASES] = {"wait", "search", "arbitration", "voting", "update", "updated"};
+
+    return (phase >= 0 && phase < STATS_PHASES) ? names[phase] : "?";
+}
@@ -0,0 +1,71 @@
+#include <stdint.h>
+
+#define STATS_MAGIC 0x54415453 /* "STAT" */
+#define STATS_VERSION 1
+
+/* stats_open return value when the segment is still being created */
+#define STATS_NOT_READY 2
+
+/* Miners with a larger index in the net are not recorded */
+#define STATS_MAX_MINERS 1024
+#define STATS_MAX_WORKERS 16
+
+/* Phases of a round */
+#define PHASE_WAIT 0 /* Waiting for the round to open */
+#define PHASE_SEARCH 1 /* Searching the target, or looking it up in the index */
+#define PHASE_ARBITRATION 2 /* handle_win, winners only */
+#define PHASE_VOTING 3 /* Voting until the result is known */
+#define PHASE_UPDATE 4 /* update_blockchain */
+#define PHASE_UPDATED_WAIT 5 /* Waiting for the others to record the block, winners only */
+#define STATS_PHASES 6
+
+/* Latencies in ns. Bucket i < 4 holds i, above each power of 2 is split in 4 */
+#define STATS_BUCKETS 256
+
+/* The segment's layout is stable: fixed width fields only, and a reader checks
+ * magic, version and the sizes in the header before reading anything else */
+typedef struct _StatsHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t max_miners;
+    uint32_t max_workers;
+    uint32_t n_phases;
+    uint32_t n_buckets;
+    uint32_t miner_size; /* sizeof(MinerStats) */
+    uint32_t reserved;
+} StatsHeader;
+
+typedef struct _Histogram {
+    uint64_t count;
+    uint64_t sum; /* ns */
+    uint64_t max; /* ns */
+    uint64_t buckets[STATS_BUCKETS];
+} Histogram;
+
+/* Written only by its miner, each worker count only by its worker. Readers may see
+ * a round half recorded */
+typedef struct _MinerStats {
+    int32_t pid; /* 0 if the slot is not in use */
+    uint32_t n_workers;
+    uint64_t rounds;
+    uint64_t wins;
+    uint64_t hashes[STATS_MAX_WORKERS]; /* Candidates searched by each worker */
+    Histogram phases[STATS_PHASES];
+} MinerStats;
+
+typedef struct _Stats {
+    StatsHeader *header; /* NULL if not mapped */
+    MinerStats *miners;
+} Stats;
+
+int stats_create(Stats *stats);
+int stats_open(Stats *stats, int writable);
+MinerStats *stats_attach(Stats *stats, int miner_ind, int n_workers);
+void stats_detach(MinerStats *miner);
+void stats_reclaim(Stats *stats, int miner_ind, int32_t pid);
+uint64_t stats_now();
+void stats_record(Histogram *histogram, uint64_t ns);
+void stats_merge(Histogram *into, const Histogram *histogram);
+uint64_t stats_percentile(const Histogram *histogram, double p);
+const char *stats_phase_name(int phase);
+void stats_close(Stats *stats);
@@ -0,0 +1,74 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include "hash.h"
+#include "chain.h"
+#include "shard.h"
+
+#define TRUE 1
+#define FALSE 0
+
+#define MAX_THREADS 64
+
+
+
+
+/*******************
+ ** Main function **
+ *******************/
+
+/* Validates a chain file, or the chain of the shard's running net if none is given */
+int main(int argc, char **argv) {
+    Chain chain;
+    ChainCheck check;
+    char backend_name[sizeof(chain.header->backend)+1];
+    int n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt, is_shm;
+    const char *name, *shard = NULL;
+
+    while ((opt = getopt(argc, argv, "t:s:")) != -1) {
+        if (opt == 't' && atoi(optarg) >= 1 && atoi(optarg) <= MAX_THREADS) n_threads = atoi(optarg);
+        else if (opt == 's') shard = optarg;
+        else {
+            argc = 0; /* Print usage */
+            break;
+        }
+    }
+
+    if (argc - optind > 1 || argc == 0) {
+        fprintf(stderr, "Error: invalid arguments\n");
+        fprintf(stdout, "Usage: %s [-t threads] [-s shard] [chain_file]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (shard_setup(shard) != EXIT_SUCCESS) exit(EXIT_FAILURE);
+    if (n_threads < 1) n_threads = 1;
+    if (n_threads > MAX_THREADS) n_threads = MAX_THREADS;
+
+    is_shm = (argc == optind);
+    name = is_shm ? shard_shm(SHM_NAME_CHAIN) : argv[optind];
+
+    if (chain_open(&chain, name, is_shm) != EXIT_SUCCESS) exit(EXIT_FAILURE);
+
+    /* Blocks are checked with the backend that mined them */
+    memcpy(backend_name, chain.header->backend, sizeof(chain.header->backend));
+    backend_name[sizeof(chain.header->backend)] = '\0';
+    if (hash_setup(backend_name) != EXIT_SUCCESS) {
+        chain_close(&chain);
+        exit(EXIT_FAILURE);
+    }
+
+    chain_check_init(&check);
+    if (chain_validate(&chain, &check, chain.header->size, n_threads) != EXIT_SUCCESS) {
+        if (check.bad != 0) fprintf(stdout, "Invalid chain: record at offset %" PRIu64 "\n", check.bad);
+        chain_close(&chain);
+        exit(EXIT_FAILURE);
+    }
+
+    fprintf(stdout, "Valid chain: %" PRIu64 " blocks, %" PRIu64 " bytes, backend %s\n", chain.header->n_blocks, check.end, backend_name);
+
+    chain_close(&chain);
+
+    exit(EXIT_SUCCESS);
+}